@@ -40,20 +40,145 @@
 
 // --- INCLUDES ---------------------------------------------------------------
 
+#ifndef USB_HOST_SIM
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#include <Print.h>
+#endif
 #include <string.h>
 
 extern "C" {
   #include "usbdrv.h"
+  #include "oddebug.h"
 }
 
 #include "usb_keymap.h"
+#include "usb_layouts.h"
 #include "unicode_chars.h"
 
 // --- TYPE DEFINITIONS -------------------------------------------------------
 
-#define BUFFER_SIZE 4 // Minimum of 2: 1 for modifiers + 1 for keystroke 
+#ifndef BUFFER_SIZE
+#define BUFFER_SIZE 4 // Minimum of 2: 1 for modifiers + 1 for keystroke, maximum of 7
+#endif
+
+#ifndef REPORT_QUEUE_SIZE
+#define REPORT_QUEUE_SIZE 16 // Pending reports, must be a power of 2 <= 128
+#endif
+
+#ifndef KEY_EVENT_QUEUE_SIZE
+#define KEY_EVENT_QUEUE_SIZE 16 // Key events postKey() can keep, must be a power of 2 <= 128
+#endif
+
+#ifndef DISCONNECT_INTERVAL
+#define DISCONNECT_INTERVAL 250 // Default ms begin() keeps the device detached
+#endif
+
+#ifndef WRITE_TIMEOUT
+#define WRITE_TIMEOUT 1000 // Default ms print() waits for the host to take reports
+#endif
+
+// With USB_POLL_TIMER 1 Timer2 interrupts every millisecond and runs the
+// work of update() (usbPoll() and the report queue) in an interruptible
+// ISR, so the sketch may block or delay() as long as it likes. Timer2 is
+// then not available for tone() or analogWrite() on pins 3 and 11.
+#ifndef USB_POLL_TIMER
+#define USB_POLL_TIMER 0
+#endif
+
+#if USB_POLL_TIMER && (defined(USB_HOST_SIM) || !defined(TIMSK2))
+#error "USB_POLL_TIMER needs Timer2 of an ATmega48/88/168/328"
+#endif
+
+// With KEYBOARD_SOF_ALIGNED 1 keyboard reports are handed to endpoint 1 in
+// the frame before the host's next poll instead of as soon as it is free,
+// so more of the states queued meanwhile can be merged. The poll times are
+// learned from the start-of-frame count, so USB_COUNT_SOF must be on.
+#ifndef KEYBOARD_SOF_ALIGNED
+#define KEYBOARD_SOF_ALIGNED 0
+#endif
+
+#if KEYBOARD_SOF_ALIGNED && !USB_COUNT_SOF
+#error "KEYBOARD_SOF_ALIGNED needs USB_COUNT_SOF"
+#endif
+
+#ifndef SCHEDULE_SIZE
+#define SCHEDULE_SIZE 8 // Timed events pending at once, at most 255
+#endif
+
+#define SCHEDULE_WHEEL_SLOTS 16 // Timing wheel size, a power of 2
+#define SCHEDULE_NONE        0xff
+
+#ifndef REPORT_CRC_CACHE
+#define REPORT_CRC_CACHE 1 // Flash table of CRCs for common reports, 0 to save 228 bytes
+#endif
+
+// Every report starts with its report ID. Without NKRO the keyboard state
+// is report 1: the modifier byte followed by BUFFER_SIZE-1 key slots.
+// KEYBOARD_NKRO is set in usbconfig.h since the descriptor length depends
+// on it. In NKRO mode the key state is a modifier byte followed by one bit
+// per usage from 0x04 (KEY_A) to 0x6B. That does not fit into one 8 byte
+// low-speed packet, so it is sent as two reports of a report ID plus 7 state
+// bytes: report 1 holds the modifiers and usages 0x04-0x33 (letters, digits
+// and the main block, so most chords need a single transfer), report 2
+// usages 0x34-0x6B.
+#if KEYBOARD_NKRO
+#define KEYBOARD_REPORTS    2
+#define REPORT_LENGTH       8
+#define NKRO_FIRST_USAGE    0x04
+#define NKRO_LAST_USAGE     0x6b
+#define NKRO_STATE_SIZE     (KEYBOARD_REPORTS * (REPORT_LENGTH - 1))
+#define KEY_STATE_SIZE      NKRO_STATE_SIZE
+#else
+#define KEYBOARD_REPORTS    1
+#define REPORT_LENGTH       (BUFFER_SIZE + 1)
+#define KEY_STATE_SIZE      BUFFER_SIZE
+#endif
+
+// The sizes above are fixed at compile time, so a setting the code cannot
+// work with stops the build here instead of misbehaving on the bus. A
+// report must fit into one 8 byte low-speed packet, the queues are indexed
+// with free running bytes masked to their size and a send function needs
+// room for a press and a release.
+#if BUFFER_SIZE < 2 || BUFFER_SIZE > 7
+#error "BUFFER_SIZE must be 2 to 7"
+#endif
+
+#if (REPORT_QUEUE_SIZE & (REPORT_QUEUE_SIZE - 1)) != 0 || \
+    REPORT_QUEUE_SIZE < 2 * KEYBOARD_REPORTS || REPORT_QUEUE_SIZE > 128
+#error "REPORT_QUEUE_SIZE must be a power of 2 from 2 (4 with NKRO) to 128"
+#endif
+
+// sendText() types a character composed with a dead key only with room
+// for both strokes.
+#if (KEYBOARD_LAYOUTS & LAYOUTS_WITH_DEAD_KEYS) && REPORT_QUEUE_SIZE < 4 * KEYBOARD_REPORTS
+#error "REPORT_QUEUE_SIZE must be at least 4 (8 with NKRO) for layouts with dead keys"
+#endif
+
+#if (KEY_EVENT_QUEUE_SIZE & (KEY_EVENT_QUEUE_SIZE - 1)) != 0 || \
+    KEY_EVENT_QUEUE_SIZE < 1 || KEY_EVENT_QUEUE_SIZE > 128
+#error "KEY_EVENT_QUEUE_SIZE must be a power of 2 up to 128"
+#endif
+
+#if SCHEDULE_SIZE < 1 || SCHEDULE_SIZE > 255
+#error "SCHEDULE_SIZE must be 1 to 255"
+#endif
+
+// Media keys are sent in a separate Consumer Control report following the
+// keyboard reports: the report ID and one 16 bit consumer usage. With
+// KEYBOARD_CONSUMER_EP3 (see usbconfig.h) it has an interface and interrupt
+// endpoint of its own, otherwise it shares endpoint 1 with the keyboard.
+#define CONSUMER_REPORT_ID      (KEYBOARD_REPORTS + 1)
+#define CONSUMER_REPORT_LENGTH  3
+
+#if KEYBOARD_CONSUMER_EP3
+#define KEYBOARD_INTERFACE      0
+#define CONSUMER_INTERFACE      1
+#define INTERRUPT1_REPORTS      KEYBOARD_REPORTS
+#else
+#define KEYBOARD_INTERFACE      0
+#define INTERRUPT1_REPORTS      CONSUMER_REPORT_ID  // all of them
+#endif
 
 
 static uchar    idleRate;           // in 4 ms units 
@@ -88,10 +213,43 @@ static uchar    idleRate;           // in 4 ms units
 //   0xc0                           // END_COLLECTION 
 // };
 
-const PROGMEM char usbHidReportDescriptor[35] = { /* USB report descriptor */
+/* The keyboard collection is followed by a Consumer Control collection for
+ * the media keys. The array is sized by its contents and checked against
+ * USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH in usbconfig.h, which the driver's
+ * configuration descriptor announces, so the two cannot drift apart.
+ */
+const PROGMEM usbDescriptorChar_t usbHidReportDescriptor[] = { /* USB report descriptor */
+#if KEYBOARD_NKRO
+  /* N-key rollover variant: every usage is a 1 bit variable, see
+   * KEYBOARD_REPORTS above for how the bitmap is split into two reports.
+   */
+  0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
+  0x09, 0x06,                    // USAGE (Keyboard)
+  0xa1, 0x01,                    // COLLECTION (Application)
+  0x85, 0x01,                    //   REPORT_ID (1)
+  0x05, 0x07,                    //   USAGE_PAGE (Keyboard)
+  0x19, 0xe0,                    //   USAGE_MINIMUM (Keyboard LeftControl)
+  0x29, 0xe7,                    //   USAGE_MAXIMUM (Keyboard Right GUI)
+  0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+  0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
+  0x75, 0x01,                    //   REPORT_SIZE (1)
+  0x95, 0x08,                    //   REPORT_COUNT (8)
+  0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+  0x19, 0x04,                    //   USAGE_MINIMUM (Keyboard a and A)
+  0x29, 0x33,                    //   USAGE_MAXIMUM (Keyboard ; and :)
+  0x95, 0x30,                    //   REPORT_COUNT (48)
+  0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+  0x85, 0x02,                    //   REPORT_ID (2)
+  0x19, 0x34,                    //   USAGE_MINIMUM (Keyboard ' and ")
+  0x29, 0x6b,                    //   USAGE_MAXIMUM (Keyboard F16)
+  0x95, 0x38,                    //   REPORT_COUNT (56)
+  0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+  0xc0,                          // END_COLLECTION
+#else
   0x05, 0x01,                    // USAGE_PAGE (Generic Desktop) 
   0x09, 0x06,                    // USAGE (Keyboard) 
   0xa1, 0x01,                    // COLLECTION (Application) 
+  0x85, 0x01,                    //   REPORT_ID (1)
   0x05, 0x07,                    //   USAGE_PAGE (Keyboard) 
   0x19, 0xe0,                    //   USAGE_MINIMUM (Keyboard LeftControl) 
   0x29, 0xe7,                    //   USAGE_MAXIMUM (Keyboard Right GUI) 
@@ -106,8 +264,95 @@ const PROGMEM char usbHidReportDescriptor[35] = { /* USB report descriptor */
   0x19, 0x00,                    //   USAGE_MINIMUM (Reserved (no event indicated)) 
   0x29, 0x65,                    //   USAGE_MAXIMUM (Keyboard Application) 
   0x81, 0x00,                    //   INPUT (Data,Ary,Abs) 
-  0xc0                           // END_COLLECTION 
+  0xc0,                          // END_COLLECTION 
+#endif
+  0x05, 0x0c,                    // USAGE_PAGE (Consumer Devices)
+  0x09, 0x01,                    // USAGE (Consumer Control)
+  0xa1, 0x01,                    // COLLECTION (Application)
+  0x85, CONSUMER_REPORT_ID,      //   REPORT_ID
+  0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+  0x26, 0xff, 0x03,              //   LOGICAL_MAXIMUM (1023)
+  0x19, 0x00,                    //   USAGE_MINIMUM (Unassigned)
+  0x2a, 0xff, 0x03,              //   USAGE_MAXIMUM (1023)
+  0x75, 0x10,                    //   REPORT_SIZE (16)
+  0x95, 0x01,                    //   REPORT_COUNT (1)
+  0x81, 0x00,                    //   INPUT (Data,Ary,Abs)
+  0xc0                           // END_COLLECTION
+};
+
+static_assert(sizeof(usbHidReportDescriptor) == USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH,
+              "USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH does not match usbHidReportDescriptor");
+
+#define CONSUMER_DESCRIPTOR_LENGTH  25
+#define KEYBOARD_DESCRIPTOR_LENGTH  (USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH - CONSUMER_DESCRIPTOR_LENGTH)
+
+#if KEYBOARD_CONSUMER_EP3
+/* Two HID interfaces: the keyboard on endpoint 1 and the Consumer Control
+ * collection on endpoint 3. Their report descriptors are the two parts of
+ * usbHidReportDescriptor above, see usbFunctionDescriptor() below. The
+ * layout follows the driver's default configuration descriptor in usbdrv.c.
+ */
+const PROGMEM usbDescriptorChar_t usbDescriptorConfiguration[59] = { /* USB configuration descriptor */
+    9,          /* sizeof(usbDescriptorConfiguration): length of descriptor in bytes */
+    USBDESCR_CONFIG,    /* descriptor type */
+    59, 0,      /* total length of data returned (including inlined descriptors) */
+    2,          /* number of interfaces in this configuration */
+    1,          /* index of this configuration */
+    0,          /* configuration name string index */
+#if USB_CFG_IS_SELF_POWERED
+    (1 << 7) | USBATTR_SELFPOWER,       /* attributes */
+#else
+    (1 << 7),                           /* attributes */
+#endif
+    USB_CFG_MAX_BUS_POWER/2,            /* max USB current in 2mA units */
+/* keyboard interface, offset 9 */
+    9,          /* sizeof(usbDescrInterface): length of descriptor in bytes */
+    USBDESCR_INTERFACE, /* descriptor type */
+    KEYBOARD_INTERFACE, /* index of this interface */
+    0,          /* alternate setting for this interface */
+    1,          /* endpoints excl 0: number of endpoint descriptors to follow */
+    USB_CFG_INTERFACE_CLASS,
+    USB_CFG_INTERFACE_SUBCLASS,
+    USB_CFG_INTERFACE_PROTOCOL,
+    0,          /* string index for interface */
+    9,          /* sizeof(usbDescrHID): length of descriptor in bytes */
+    USBDESCR_HID,   /* descriptor type: HID */
+    0x01, 0x01, /* BCD representation of HID version */
+    0x00,       /* target country code */
+    0x01,       /* number of HID Report (or other HID class) Descriptor infos to follow */
+    0x22,       /* descriptor type: report */
+    KEYBOARD_DESCRIPTOR_LENGTH, 0,  /* total length of report descriptor */
+    7,          /* sizeof(usbDescrEndpoint) */
+    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
+    (usbDescriptorChar_t)0x81, /* IN endpoint number 1 */
+    0x03,       /* attrib: Interrupt endpoint */
+    8, 0,       /* maximum packet size */
+    USB_CFG_INTR_POLL_INTERVAL, /* in ms */
+/* consumer control interface, offset 34 */
+    9,          /* sizeof(usbDescrInterface): length of descriptor in bytes */
+    USBDESCR_INTERFACE, /* descriptor type */
+    CONSUMER_INTERFACE, /* index of this interface */
+    0,          /* alternate setting for this interface */
+    1,          /* endpoints excl 0: number of endpoint descriptors to follow */
+    0x03,       /* HID */
+    0,          /* no subclass */
+    0,          /* no protocol */
+    0,          /* string index for interface */
+    9,          /* sizeof(usbDescrHID): length of descriptor in bytes */
+    USBDESCR_HID,   /* descriptor type: HID */
+    0x01, 0x01, /* BCD representation of HID version */
+    0x00,       /* target country code */
+    0x01,       /* number of HID Report (or other HID class) Descriptor infos to follow */
+    0x22,       /* descriptor type: report */
+    CONSUMER_DESCRIPTOR_LENGTH, 0,  /* total length of report descriptor */
+    7,          /* sizeof(usbDescrEndpoint) */
+    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
+    (usbDescriptorChar_t)(0x80 | USB_CFG_EP3_NUMBER), /* IN endpoint number 3 */
+    0x03,       /* attrib: Interrupt endpoint */
+    8, 0,       /* maximum packet size */
+    USB_CFG_INTR_POLL_INTERVAL, /* in ms */
 };
+#endif
 
 
 /* Keyboard usage values, see usb.org's HID-usage-tables document, chapter
@@ -259,143 +504,1468 @@ const PROGMEM char usbHidReportDescriptor[35] = { /* USB report descriptor */
 #define KEY_VOL_UP          0x80    // Keyboard Volume Up
 #define KEY_VOL_DOWN        0x81    // Keyboard Volume Down
 
-#define KEY_PLAY            0xB0    // Keyboard Play
-#define KEY_PAUSE           0xB1    // Keyboard Pause
-#define KEY_RECORD          0xB2    // Keyboard Record
-#define KEY_FAST_FORWARD    0xB3    // Keyboard Fast Forward
-#define KEY_REWIND          0xB4    // Keyboard Rewind
-#define KEY_NEXT_TRACK      0xB5    // Keyboard Scan Next Track
-#define KEY_PREVIOUS_TRACK  0xB6    // Keyboard Scan Previous Track
-#define KEY_STOP            0xB7    // Keyboard Stop
+/* Consumer usage values for sendConsumerKeyStroke(), see usb.org's
+ * HID-usage-tables document, chapter 15 Consumer Page for more codes.
+ */
+#define CONSUMER_PLAY           0x00B0  // Play
+#define CONSUMER_PAUSE          0x00B1  // Pause
+#define CONSUMER_RECORD         0x00B2  // Record
+#define CONSUMER_FAST_FORWARD   0x00B3  // Fast Forward
+#define CONSUMER_REWIND         0x00B4  // Rewind
+#define CONSUMER_NEXT_TRACK     0x00B5  // Scan Next Track
+#define CONSUMER_PREVIOUS_TRACK 0x00B6  // Scan Previous Track
+#define CONSUMER_STOP           0x00B7  // Stop
+#define CONSUMER_EJECT          0x00B8  // Eject
+#define CONSUMER_PLAY_PAUSE     0x00CD  // Play/Pause
+#define CONSUMER_MUTE           0x00E2  // Mute
+#define CONSUMER_VOLUME_UP      0x00E9  // Volume Increment
+#define CONSUMER_VOLUME_DOWN    0x00EA  // Volume Decrement
+
+// Older names of the consumer usages. KEY_PAUSE and KEY_STOP are the
+// Keyboard page usages defined above.
+#define KEY_PLAY            CONSUMER_PLAY
+#define KEY_RECORD          CONSUMER_RECORD
+#define KEY_FAST_FORWARD    CONSUMER_FAST_FORWARD
+#define KEY_REWIND          CONSUMER_REWIND
+#define KEY_NEXT_TRACK      CONSUMER_NEXT_TRACK
+#define KEY_PREVIOUS_TRACK  CONSUMER_PREVIOUS_TRACK
 
 
-class UsbKeyboardDevice {
+#if REPORT_CRC_CACHE && !KEYBOARD_NKRO
+/* The release report and the reports with one key of usage 0x04 to 0x3B
+ * (letters, digits, Enter, Escape, Backspace, Tab, Space, punctuation, Caps
+ * Lock, F1 and F2), unshifted and with left shift, make up almost all of
+ * the reports sent while typing. Their CRCs are calculated by the compiler
+ * and stored in flash so that update() does not have to run the CRC loop
+ * for them. The table depends on BUFFER_SIZE.
+ */
+#define CRC_CACHE_FIRST_KEY     0x04
+#define CRC_CACHE_LAST_KEY      0x3b
+#define CRC_CACHE_ENTRIES       (CRC_CACHE_LAST_KEY - CRC_CACHE_FIRST_KEY + 2)
+
+// The CRC16 of usbCrc16(), one bit, byte and zero byte at a time.
+constexpr uint16_t crcBits(uint16_t crc, uint8_t bits) {
+  return bits == 0 ? crc : crcBits((crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1, bits - 1);
+}
+
+constexpr uint16_t crcByte(uint16_t crc, uint8_t data) {
+  return crcBits(crc ^ data, 8);
+}
+
+constexpr uint16_t crcZeros(uint16_t crc, uint8_t count) {
+  return count == 0 ? crc : crcZeros(crcByte(crc, 0), count - 1);
+}
+
+// CRC of keyboard report 1 with the given modifiers and a single key.
+constexpr uint16_t reportCrc(uint8_t modifiers, uint8_t key) {
+  return crcZeros(crcByte(crcByte(crcByte(0xffff, 1), modifiers), key),
+                  BUFFER_SIZE - 2) ^ 0xffff;
+}
+
+#define REPORT_CRC_ROW(m, k)                                           \
+  reportCrc(m, k),     reportCrc(m, k + 1), reportCrc(m, k + 2),       \
+  reportCrc(m, k + 3), reportCrc(m, k + 4), reportCrc(m, k + 5),       \
+  reportCrc(m, k + 6), reportCrc(m, k + 7)
+
+#define REPORT_CRC_TABLE(m)                                            \
+  { reportCrc(m, 0),                                                   \
+    REPORT_CRC_ROW(m, 0x04), REPORT_CRC_ROW(m, 0x0c),                  \
+    REPORT_CRC_ROW(m, 0x14), REPORT_CRC_ROW(m, 0x1c),                  \
+    REPORT_CRC_ROW(m, 0x24), REPORT_CRC_ROW(m, 0x2c),                  \
+    REPORT_CRC_ROW(m, 0x34) }
+
+// Indexed by [shifted][key], key 0 is the release report and key n the
+// usage CRC_CACHE_FIRST_KEY + n - 1.
+const PROGMEM uint16_t reportCrcCache[2][CRC_CACHE_ENTRIES] = {
+  REPORT_CRC_TABLE(0),
+  REPORT_CRC_TABLE(MOD_SHIFT_LEFT),
+};
+#endif
+
+
+// Ring indices shared with an interrupt are read and written once per
+// access, the ring slots written before and read after the index that
+// hands them over. A byte access is atomic on the AVR, so this only keeps
+// the compiler from caching the index or moving slot accesses across it.
+// The host simulation may post from another thread and uses the GCC
+// atomic builtins instead.
+#ifdef USB_HOST_SIM
+#define RING_LOAD(index)         __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define RING_STORE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#else
+#define RING_LOAD(index)         ringLoad(&(index))
+#define RING_STORE(index, value) ringStore(&(index), (value))
+
+static inline uchar ringLoad(const uchar *index) {
+  uchar value = *(const volatile uchar *)index;
+
+  asm volatile("" ::: "memory");
+  return value;
+}
+
+static inline void ringStore(uchar *index, uchar value) {
+  asm volatile("" ::: "memory");
+  *(volatile uchar *)index = value;
+}
+#endif
+
+class UsbKeyboardDevice : public Print {
  public:
+  // Only sets up the library's own state, the USB port is left alone until
+  // begin() so that the global instance has no side effects before setup().
   UsbKeyboardDevice () {
-    PORTD = 0; // TODO: Only for USB pins?
-    DDRD |= ~USBMASK;
-
-    cli();
-    usbDeviceDisconnect();
-    usbDeviceConnect();
+    running = false;
+    connecting = false;
+    eventTail = 0;
+    textLayout = KEYBOARD_LAYOUT;
+    writeTimeout = WRITE_TIMEOUT;
+    reset();
+  }
 
+  // Starts the driver and attaches to the bus. The device first stays
+  // detached for disconnectMs so that the host notices a re-attach even
+  // after a reset of the microcontroller alone. The wait does not block:
+  // update() attaches once it has passed, so setup() can go on to bring up
+  // other peripherals meanwhile. Keystrokes may be queued right away, they
+  // are sent once the host has configured the device.
+  void begin(uint16_t disconnectMs = DISCONNECT_INTERVAL) {
+    USBOUT &= ~USBMASK; // D+ and D- are inputs without pull-ups
+    USBDDR &= ~USBMASK;
+    odDebugInit();      // UART for DEBUG_LEVEL > 0, see oddebug.h
 
+    cli();
     usbInit();
-      
+    detach();
     sei();
 
-    // TODO: Remove the next two lines once we fix
-    //       missing first keystroke bug properly.
-    memset(reportBuffer, 0, sizeof(reportBuffer));      
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
+#if USB_COUNT_SOF
+    lastSof = usbSofCount;
+#else
+    frameClock = millis();
+#endif
+    wheelTime = frameClock;
+
+    running = true;
+    reenumerate(disconnectMs);
+
+#if USB_POLL_TIMER
+    // CTC mode, clock / 128: one compare match per millisecond.
+    TCCR2A = 1 << WGM21;
+    TCCR2B = (1 << CS22) | (1 << CS20);
+    OCR2A = F_CPU / 128 / 1000 - 1;
+    TIMSK2 |= 1 << OCIE2A;
+#endif
   }
-    
+
+  // Detaches from the bus and stops the driver. Queued reports are dropped.
+  void end() {
+#if USB_POLL_TIMER
+    TIMSK2 &= ~(1 << OCIE2A);
+#endif
+    detach();
+    running = false;
+    connecting = false;
+    reset();
+  }
+
+  // Detaches for disconnectMs and attaches again, which makes the host
+  // enumerate the device anew. Queued reports are kept and sent once it is
+  // configured again.
+  void reenumerate(uint16_t disconnectMs = DISCONNECT_INTERVAL) {
+    ServiceLock lock;
+
+    if (!running) {
+      return;
+    }
+    detach();
+    connectStamp = millis();
+    disconnectInterval = disconnectMs;
+    connecting = true;
+    if (disconnectMs == 0) {
+      attach();
+    }
+  }
+
+  // True while the device is attached to the bus, i.e. from the end of the
+  // disconnect interval of begin() or reenumerate() until end().
+  bool isAttached() {
+    return running && !connecting;
+  }
+
+  // Services the bus and moves queued reports to the host. Call it at
+  // least every 50 ms, or let the timer do it with USB_POLL_TIMER.
   void update() {
+#if USB_POLL_TIMER
+    // The timer interrupt does the work. Passing the lock makes the
+    // caller's next look at the queue see what has been sent meanwhile.
+    ServiceLock lock;
+#else
+    service();
+#endif
+  }
+
+  // The work of update(). With USB_POLL_TIMER only the timer interrupt
+  // calls this.
+  void service() {
+    if (!running) {
+      return;
+    }
+    if (connecting) {
+      if ((uint16_t)(millis() - connectStamp) < disconnectInterval) {
+        return;
+      }
+      attach();
+    }
+
     usbPoll();
+    odTraceFlush(); // debug trace to the UART, never waits
+    runSchedule();
+    applyKeyEvents();
+
+    // Reports wait in the queue until the host has configured the device.
+    // A report handed to the endpoint before that is sent as soon as the
+    // host starts polling and may reach it before its keyboard driver does,
+    // which lost the first keystroke. From SET_CONFIGURATION on the queue
+    // is flushed at the endpoint's pace.
+    if (!isConfigured()) {
+      return;
+    }
+
+#if KEYBOARD_CONSUMER_EP3
+    // Endpoint 3 carries only the consumer report, refill it as soon as
+    // the host has taken the previous one. Typing on endpoint 1 never
+    // waits for it.
+    if ((consumerPending != 0 || consumerHeld) && usbInterruptIsReady3()) {
+      sendConsumerReport();
+    }
+#endif
+
+#if KEYBOARD_SOF_ALIGNED
+    trackHostPoll();
+#endif
+    if (!usbInterruptIsReady()) {
+      return;
+    }
+
+    // Move the next pending report into the interrupt endpoint once the
+    // host has collected the previous one. The reports are copied straight
+    // from the queue into the driver's transmit buffer, which still holds
+    // the last report sent until then: a queued copy of it carries no new
+    // state and is dropped instead of costing another transfer, and so is
+    // a state the host does not need to see (see stateRedundant()). The
+    // consumer slot and the keyboard queue take turns while both have work.
+    uint16_t now = frameClock;
+#if !KEYBOARD_CONSUMER_EP3
+    if ((consumerPending != 0 || consumerHeld) &&
+        (consumerTurn || queueHead == queueTail)) {
+      sendConsumerReport();
+      consumerTurn = false;
+      idleStamp = now;
+      return;
+    }
+    consumerTurn = true;
+#endif
+#if KEYBOARD_SOF_ALIGNED
+    // The queue waits for the frame before the next poll so that the
+    // states queued meanwhile can be coalesced.
+    if (queueHead != queueTail && !publishDue()) {
+      return;
+    }
+#endif
+    while (queueHead != queueTail) {
+      uchar *report = reportQueue[queueHead & (REPORT_QUEUE_SIZE - 1)];
+      uchar *tx = usbInterruptBuffer();
+
+      queueHead++;
+#if !KEYBOARD_NKRO
+      if (stateRedundant(report, tx)) {
+        continue;
+      }
+#endif
+      if (memcmp(report, tx, REPORT_LENGTH) != 0) {
+        memcpy(tx, report, REPORT_LENGTH);
+        commitReport();
+        idleStamp = now;
+        return;
+      }
+    }
+
+    // With a non-zero idle rate the host wants the current state repeated
+    // every idleRate * 4 ms even if nothing changed, one report ID per
+    // transfer. The consumer interface on endpoint 3 has no idle repeat.
+    if (idleRate != 0 && (uint16_t)(now - idleStamp) >= idleRate * 4) {
+      idleRepeat = INTERRUPT1_REPORTS;
+      idleStamp = now;
+    }
+    if (idleRepeat != 0) {
+      uint8_t reportId = INTERRUPT1_REPORTS - idleRepeat + 1;
+
+      usbSetInterrupt(lastReport(reportId), reportLength(reportId));
+      idleRepeat--;
+    }
+  }
+
+  // The time base of the scheduler in milliseconds. With USB_COUNT_SOF it
+  // counts the host's start-of-frame markers, which come every 1 ms while
+  // the bus is active, and stands still while the host suspends the bus.
+  // Otherwise it follows millis(). It advances in update().
+  uint16_t frames() {
+    return frameClock;
+  }
+
+  // Calls callback(arg) from update() once delayMs frames have passed, at
+  // the earliest in the next frame. The callback may send keys and schedule
+  // itself again, which paces a macro. With USB_POLL_TIMER it runs in the
+  // timer interrupt. Returns 0 if SCHEDULE_SIZE events are pending already.
+  uint8_t schedule(uint16_t delayMs, void (*callback)(void *), void *arg) {
+    ServiceLock lock;
+    uchar event = addEvent(delayMs, SCHEDULE_CALL);
+
+    if (event == SCHEDULE_NONE) {
+      return 0;
+    }
+    events[event].callback = callback;
+    events[event].arg = arg;
+    return 1;
+  }
+
+  // Presses a key now and releases all keys after holdMs. Held for longer
+  // than the host's typematic delay, the key repeats on the host. Returns 0
+  // without queueing anything if there is no room in the queue or the
+  // schedule.
+  uint8_t pressKeyFor(uint8_t keyStroke, uint8_t modifiers, uint16_t holdMs) {
+    ServiceLock lock;
+
+    if (queueSpace() < 2 * KEYBOARD_REPORTS ||
+        addEvent(holdMs, SCHEDULE_RELEASE) == SCHEDULE_NONE) {
+      return 0;
+    }
+    queueReport(modifiers, keyStroke);
+    return 1;
+  }
+
+  // Types text like sendText(), but one character every intervalMs, the
+  // first one in the next frame. The text is read while it is typed and
+  // must stay valid until pacedTextLeft() is 0. Returns 0 if paced text is
+  // being typed already or the schedule is full.
+  uint8_t sendTextPaced(const char *text, uint16_t len, uint16_t intervalMs) {
+    ServiceLock lock;
+
+    if (pacedLeft != 0 || len == 0 ||
+        addEvent(1, SCHEDULE_TEXT) == SCHEDULE_NONE) {
+      return 0;
+    }
+    pacedText = text;
+    pacedLeft = len;
+    pacedInterval = intervalMs;
+    return 1;
   }
-    
-  void sendKeyStroke(uint8_t keyStroke) {
-    sendKeyStroke(keyStroke, 0);
-  }
-
-  void sendKeyStroke(uint8_t keyStroke, uint8_t modifiers) {
-      
-    while (!usbInterruptIsReady()) {
-      // Note: We wait until we can send keystroke
-      //       so we know the previous keystroke was
-      //       sent.
-    }
-      
-    memset(reportBuffer, 0, sizeof(reportBuffer));
-
-    reportBuffer[0] = modifiers;
-    reportBuffer[1] = keyStroke;
-        
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
-
-    while (!usbInterruptIsReady()) {
-      // Note: We wait until we can send keystroke
-      //       so we know the previous keystroke was
-      //       sent.
-    } 
-      
-    // This stops endlessly repeating keystrokes:
-    memset(reportBuffer, 0, sizeof(reportBuffer));      
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
 
+  // Bytes of the paced text still to be typed.
+  uint16_t pacedTextLeft() {
+    ServiceLock lock;
+
+    return pacedLeft;
+  }
+
+  // The current report with the given report ID, i.e. the one queued
+  // last. Unknown IDs return the first keyboard report. Without NKRO this
+  // is the most recently written queue slot, which is never overwritten
+  // before a newer report has been queued.
+  uchar *lastReport(uint8_t reportId) {
+    if (reportId == CONSUMER_REPORT_ID) {
+      return consumerReport;
+    }
+#if KEYBOARD_NKRO
+    if (reportId >= 1 && reportId <= KEYBOARD_REPORTS) {
+      return queuedReports[reportId - 1];
+    }
+    return queuedReports[0];
+#else
+    return reportQueue[(uchar)(queueTail - 1) & (REPORT_QUEUE_SIZE - 1)];
+#endif
+  }
+
+  static uint8_t reportLength(uint8_t reportId) {
+    return reportId == CONSUMER_REPORT_ID ? CONSUMER_REPORT_LENGTH : REPORT_LENGTH;
+  }
+
+  // True once the host has set a configuration, false again after a bus
+  // reset. Keystrokes sent before that are held in the queue.
+  bool isConfigured() {
+    return usbConfiguration != 0;
+  }
+
+#ifdef USB_HOST_SIM
+  // Keyboard reports whose CRC came from the flash table and reports whose
+  // CRC had to be calculated, see REPORT_CRC_CACHE. Only counted in the
+  // host simulation, for bench.cpp.
+  uint32_t crcCacheHits() {
+    return crcHits;
+  }
+
+  uint32_t crcCacheMisses() {
+    return crcMisses;
+  }
+#endif
+
+  // Number of reports that can still be queued without blocking.
+  uint8_t queueSpace() {
+    return REPORT_QUEUE_SIZE - (uint8_t)(queueTail - queueHead);
   }
 
-  void sendUnicodeKeyStroke(uint8_t *keyStrokes) {
-    sendUnicodeKeyStroke(keyStrokes, 6);
+  // True once every queued report has been handed to the driver.
+  bool queueEmpty() {
+    return queueHead == queueTail;
   }
 
-  void sendUnicodeKeyStroke(uint8_t *keyStrokes, uint8_t size) {
+  // The send functions below never wait for the host. They queue a key
+  // press followed by a release and return 1, or return 0 without queueing
+  // anything if there is not enough room. Call update() to drain the queue.
+  // In NKRO mode keys outside the bitmap are not sent.
+  uint8_t sendKeyStroke(uint8_t keyStroke) {
+    return sendKeyStroke(keyStroke, 0);
+  }
 
-    while (!usbInterruptIsReady()) {
-      // Note: We wait until we can send keystroke 
-      //       so we know the previous keystroke was
-      //       sent. 
+  uint8_t sendKeyStroke(uint8_t keyStroke, uint8_t modifiers) {
+    ServiceLock lock;
+
+    if (queueSpace() < 2 * KEYBOARD_REPORTS) {
+      return 0;
     }
 
-    memset(reportBuffer, 0, sizeof(reportBuffer));
+    queueReport(modifiers, keyStroke);
+
+    // This stops endlessly repeating keystrokes:
+    queueReport(0, 0);
+    return 1;
+  }
+
+  uint8_t sendUnicodeKeyStroke(uint8_t *keyStrokes) {
+    return sendUnicodeKeyStroke(keyStrokes, 6);
+  }
+
+  uint8_t sendUnicodeKeyStroke(uint8_t *keyStrokes, uint8_t size) {
+    ServiceLock lock;
+
+    if (queueSpace() < (size + 1) * KEYBOARD_REPORTS) {
+      return 0;
+    }
 
     for(uint8_t i=0; i<size; i++) {
-        reportBuffer[0] = MOD_ALT_LEFT;
-        reportBuffer[1] = keyStrokes[i];
+        queueReport(MOD_ALT_LEFT, keyStrokes[i]);
+    }
 
-        usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
+    // This stops endlessly repeating keystrokes:
+    queueReport(0, 0);
+    return 1;
+  }
+
+  // Presses and releases a consumer usage such as CONSUMER_PLAY_PAUSE in
+  // the Consumer Control report. Media keys have a pending slot of their
+  // own and do not use the keyboard queue, so they can be interleaved with
+  // typing. Returns 0 if the previous consumer key has not been pressed yet.
+  uint8_t sendConsumerKeyStroke(uint16_t usage) {
+    ServiceLock lock;
+
+    if (consumerPending != 0 || usage == 0) {
+      return 0;
+    }
+    consumerPending = usage;
+    return 1;
+  }
+
+  // Selects the layout the host translates keys with, LAYOUT_US,
+  // LAYOUT_UK, LAYOUT_DE or LAYOUT_FR (see usb_layouts.h), for the text
+  // typed from now on. Returns 0 if the layout is not in KEYBOARD_LAYOUTS.
+  uint8_t setLayout(uint8_t layout) {
+    if (layout >= LAYOUT_COUNT || !(KEYBOARD_LAYOUTS & (1 << layout))) {
+      return 0;
+    }
+    textLayout = layout;
+    return 1;
+  }
+
+  // Types UTF-8 text using the layout set with setLayout(). Consecutive
+  // characters are packed into the BUFFER_SIZE-1 key slots of one report as
+  // long as they need the same modifiers and no key is already down. A
+  // release report is only queued where a key repeats, the modifiers change
+  // or the text ends, so the host still sees the key-downs in text order.
+  // A character composed with a dead key starts a new report after the
+  // dead key's stroke and release. Characters the layout has no key for
+  // and malformed bytes are skipped. Returns the number of bytes consumed,
+  // which is less than len if the queue filled up or the last character is
+  // cut off; pass the rest again later.
+  uint16_t sendText(const char *text, uint16_t len) {
+    ServiceLock lock;
+    uint16_t done = 0;
+    uchar    state[BUFFER_SIZE];
+    uchar    held[BUFFER_SIZE]; // last queued state while its keys are down
+    bool     holding = false;
+
+    while (done < len) {
+      uint16_t entry;
+      uint8_t  size = textEntry(text + done, len - done, &entry);
+
+      if (size == 0) {
+        break;
+      }
+      if (entry == 0) {
+        done += size;
+        continue;
+      }
 
-        while (!usbInterruptIsReady()) {
-          // Note: We wait until we can send keystroke 
-          //       so we know the previous keystroke was
-          //       sent. 
+      uint8_t dead = LAYOUT_DEAD_KEY(entry);
+      if (holding && (dead != 0 || layoutModifiers(entry) != held[0] ||
+                      reportHasKey(held, (uint8_t)entry))) {
+        // There is always room: we reserved it when queueing held.
+        queueReport(0, 0);
+        holding = false;
+        continue;
+      }
+      // Room for this state and the release which ends the text, and for
+      // the stroke and release of the dead key before them.
+      if (queueSpace() < (dead != 0 ? 4 : 2) * KEYBOARD_REPORTS) {
+        break;
+      }
+      if (dead != 0) {
+        uint16_t deadKey = layoutEntry(LAYOUT_DEAD_KEYS + dead);
+
+        queueReport(layoutModifiers(deadKey), (uint8_t)deadKey);
+        queueReport(0, 0);
+      }
+
+      uint8_t slot = 1;
+
+      memset(state, 0, BUFFER_SIZE);
+      state[0] = layoutModifiers(entry);
+      while (done < len && slot < BUFFER_SIZE) {
+        size = textEntry(text + done, len - done, &entry);
+        if (size == 0) {
+          break;
+        }
+        if (entry == 0) {
+          done += size;
+          continue;
         }
+
+        uint8_t key = (uint8_t)entry;
+        if ((slot > 1 && LAYOUT_DEAD_KEY(entry) != 0) ||
+            layoutModifiers(entry) != state[0] || !keyFits(state, slot, key) ||
+            (holding && reportHasKey(held, key))) {
+          break;
+        }
+        state[slot++] = key;
+        done += size;
+      }
+      queueState(state);
+      memcpy(held, state, BUFFER_SIZE);
+      holding = true;
     }
-    
 
     // This stops endlessly repeating keystrokes:
-    memset(reportBuffer, 0, sizeof(reportBuffer));      
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
+    if (holding) {
+      queueReport(0, 0);
+    }
+    return done;
   }
 
-  void sendConsumerKeyStroke(uint8_t keyStroke) {
-    sendKeyStroke(keyStroke, 0);
+  uint16_t sendString(const char *text) {
+    return sendText(text, strlen(text));
   }
 
-  void sendConsumerKeyStroke(uint8_t keyStroke, uint8_t modifiers) {
-      
-    while (!usbInterruptIsReady()) {
-      // Note: We wait until we can send keystroke
-      //       so we know the previous keystroke was
-      //       sent.
+  // Print: print(), println() and write() type text like sendText(), so
+  // print(value) types a number without going through the key codes.
+  // Unlike sendText() they wait while the queue is full, running update()
+  // meanwhile, as long as the host keeps taking reports: if the queue has
+  // not moved for the write timeout, the rest is dropped and getWriteError()
+  // is set. A UTF-8 character must be written whole. The timeout is kept
+  // with millis(), so Timer0 must be running; the frame clock would not do,
+  // with USB_COUNT_SOF it stops along with a host that stops polling.
+  size_t write(const uint8_t *buffer, size_t size) {
+    const char *text = (const char *)buffer;
+    size_t   done = 0;
+    uint16_t since = millis();  // last progress
+
+    while (done < size) {
+      uint16_t n = sendText(text + done, size - done < 0xffff ? size - done : 0xffff);
+
+      done += n;
+      if (n != 0) {
+        since = millis();
+      } else if (queueSpace() >= 4 * KEYBOARD_REPORTS) {
+        break;  // a character cut off at the end, any other would fit
+      }
+      if (done < size && !waitForHost(since)) {
+        break;
+      }
     }
-      
-    memset(reportBuffer, 0, sizeof(reportBuffer));
+    if (done < size) {
+      setWriteError();
+    }
+    return done;
+  }
 
-    reportBuffer[0] = modifiers;
-    reportBuffer[1] = keyStroke;
-        
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
+  // A single character packs with nothing, it costs a report to press and
+  // one to release. Prefer writing whole strings or the formatters below.
+  size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
 
-    while (!usbInterruptIsReady()) {
-      // Note: We wait until we can send keystroke
-      //       so we know the previous keystroke was
-      //       sent.
-    } 
-      
-    // This stops endlessly repeating keystrokes:
-    memset(reportBuffer, 0, sizeof(reportBuffer));      
-    usbSetInterrupt(reportBuffer, sizeof(reportBuffer));
+  using Print::write;
+
+  // Waits until the host has taken every queued report, for at most the
+  // write timeout (timed with millis() like write()).
+  void flush() {
+    uint16_t since = millis();
 
+    while (!queueEmpty() && waitForHost(since)) {
+    }
+  }
+
+  // Milliseconds write() and flush() wait for the host, WRITE_TIMEOUT by
+  // default. 0 makes them return right away, like sendText().
+  void setWriteTimeout(uint16_t ms) {
+    writeTimeout = ms;
   }
-     
-  //private: TODO: Make friend?
-  uchar    reportBuffer[4];    // buffer for HID reports [ 1 modifier byte + (len-1) key strokes]
 
+  // Types value / 10^decimals with that many decimals, 1234 and 2 as 12.34,
+  // -5 and 2 as -0.05. Readings kept in fixed point type much faster this
+  // way than with print(double), which writes every digit on its own: the
+  // number is formatted on the stack and written at once, so its digits
+  // are packed into shared reports. Returns the characters typed.
+  size_t printFixed(int32_t value, uint8_t decimals) {
+    char     buf[13];     // sign, 11 digits and the point
+    char    *p = buf + sizeof(buf);
+    uint32_t n = value < 0 ? 0UL - (uint32_t)value : value;
+    uint8_t  digits = 0;
+
+    decimals = decimals < 10 ? decimals : 10;
+    do {
+      if (digits == decimals && digits != 0) {
+        *--p = '.';
+      }
+      *--p = '0' + n % 10;
+      n /= 10;
+      digits++;
+    } while (n != 0 || digits <= decimals);
+    if (value < 0) {
+      *--p = '-';
+    }
+    return write((const uint8_t *)p, buf + sizeof(buf) - p);
+  }
+
+  // Types value in upper case hex, zero padded to at least digits digits
+  // (at most 8), e.g. 0x2f with 4 as 002F. Written at once like
+  // printFixed(). Returns the characters typed.
+  size_t printHex(uint32_t value, uint8_t digits = 1) {
+    char  buf[8];
+    char *p = buf + sizeof(buf);
+
+    digits = digits < 8 ? digits : 8;
+    do {
+      uint8_t d = value & 0x0f;
+
+      *--p = d < 10 ? '0' + d : 'A' - 10 + d;
+      value >>= 4;
+    } while (value != 0 || p > buf + sizeof(buf) - digits);
+    return write((const uint8_t *)p, buf + sizeof(buf) - p);
+  }
+
+  // Posts a key or modifier usage going down or up, for key matrix scans
+  // and pin change handlers running in an interrupt. update() applies the
+  // events in order like press() and release(); one that finds no free
+  // key slot is dropped. The event ring has one writer, the context that
+  // posts, and one reader, update(), each owning one of its byte indices,
+  // so neither side ever waits for the other or disables interrupts. Post
+  // from a single context only. Returns 0 if the ring is full.
+  uint8_t postKey(uint8_t key, bool down) {
+    uchar tail = eventTail;
+
+    if ((uchar)(tail - RING_LOAD(eventHead)) >= KEY_EVENT_QUEUE_SIZE) {
+      return 0;
+    }
+    keyEvents[tail & (KEY_EVENT_QUEUE_SIZE - 1)][0] = key;
+    keyEvents[tail & (KEY_EVENT_QUEUE_SIZE - 1)][1] = down;
+    RING_STORE(eventTail, (uchar)(tail + 1));
+    return 1;
+  }
+
+  // Held keys. press() and release() change one key of the current key
+  // state, the one queued last, setModifiers() replaces its modifier byte
+  // and releaseAll() lets go of everything. The modifiers can also be
+  // pressed as the usages 0xE0 (left control) to 0xE7 (right GUI). A change
+  // queues one report, one per changed report ID in NKRO mode; a call that
+  // leaves the state as it is queues nothing. They return 0 and change
+  // nothing if the queue is full or press() finds no free key slot, or no
+  // bitmap bit in NKRO mode. The send functions above end with all keys
+  // released, including the held ones.
+  uint8_t press(uint8_t key) {
+    ServiceLock lock;
+    uchar state[KEY_STATE_SIZE];
+
+    keyState(state);
+    return changeKey(state, key, true) && queueKeyState(state);
+  }
+
+  uint8_t release(uint8_t key) {
+    ServiceLock lock;
+    uchar state[KEY_STATE_SIZE];
+
+    keyState(state);
+    return changeKey(state, key, false) && queueKeyState(state);
+  }
+
+  uint8_t releaseAll() {
+    ServiceLock lock;
+    uchar state[KEY_STATE_SIZE];
+
+    memset(state, 0, KEY_STATE_SIZE);
+    return queueKeyState(state);
+  }
+
+  uint8_t setModifiers(uint8_t modifiers) {
+    ServiceLock lock;
+    uchar state[KEY_STATE_SIZE];
+
+    keyState(state);
+    state[0] = modifiers;
+    return queueKeyState(state);
+  }
+
+#if KEYBOARD_NKRO
+  // N-key rollover encoder. setKeyBit() and clearKeyBit() change a single
+  // usage of the pending key state in constant time, the modifiers are the
+  // usages 0xE0 (left control) to 0xE7 (right GUI). Both return 0 for a
+  // usage the bitmap has no bit for. sendKeyBits() queues a snapshot of the
+  // pending state: only the reports whose bits changed since the last state
+  // was queued, so a chord within report 1 costs one transfer. It returns 0
+  // without queueing anything if there is not enough room.
+  uint8_t setKeyBit(uint8_t usage) {
+    uint8_t index, mask;
+
+    if (!usageBit(usage, &index, &mask)) {
+      return 0;
+    }
+    keyBits[index] |= mask;
+    return 1;
+  }
+
+  uint8_t clearKeyBit(uint8_t usage) {
+    uint8_t index, mask;
+
+    if (!usageBit(usage, &index, &mask)) {
+      return 0;
+    }
+    keyBits[index] &= ~mask;
+    return 1;
+  }
+
+  uint8_t sendKeyBits() {
+    ServiceLock lock;
+
+    if (queueSpace() < KEYBOARD_REPORTS) {
+      return 0;
+    }
+    queueBits(keyBits);
+    return 1;
+  }
+#endif
+
+ private:
+  // Scheduled events wait in a timing wheel: the list of slot t holds the
+  // events whose due frame is t modulo SCHEDULE_WHEEL_SLOTS, so a frame only
+  // looks at its own short list however many events are pending.
+  enum { SCHEDULE_CALL, SCHEDULE_RELEASE, SCHEDULE_TEXT };
+
+  struct ScheduledEvent {
+    uint16_t due;       // frame to run in
+    uchar    next;      // next event in the wheel slot or the free list
+    uchar    action;    // SCHEDULE_*
+    void   (*callback)(void *);
+    void    *arg;
+  };
+
+  // Keeps the timer interrupt from running service() while the sketch
+  // changes the queue or the consumer slot, for the lifetime of the object.
+  // Only the timer interrupt is masked, the USB interrupt stays enabled.
+  // The empty asm statements stop the compiler from moving memory accesses
+  // out of the locked section. Without USB_POLL_TIMER it does nothing.
+  struct ServiceLock {
+#if USB_POLL_TIMER
+    uchar enabled;
+
+    ServiceLock() {
+      enabled = TIMSK2 & (1 << OCIE2A);
+      TIMSK2 &= ~(1 << OCIE2A);
+      asm volatile("" ::: "memory");
+    }
+
+    ~ServiceLock() {
+      asm volatile("" ::: "memory");
+      TIMSK2 |= enabled;
+    }
+#else
+    ~ServiceLock() {}
+#endif
+  };
+
+  // One round of waiting in write() and flush(): lets the host take
+  // reports, like loop() calling update() would. Returns false without
+  // waiting once the keyboard is stopped or since is writeTimeout ago.
+  bool waitForHost(uint16_t since) {
+    if (!running || (uint16_t)(millis() - since) >= writeTimeout) {
+      return false;
+    }
+    update();
+    yield();
+    return true;
+  }
+
+  // Puts the queue and the report state back to all keys released.
+  void reset() {
+    memset(wheel, SCHEDULE_NONE, sizeof(wheel));
+    for (uint8_t i = 0; i < SCHEDULE_SIZE; i++) {
+      events[i].next = i + 1 < SCHEDULE_SIZE ? i + 1 : SCHEDULE_NONE;
+    }
+    freeEvent = 0;
+    pacedLeft = 0;
+    frameClock = 0;
+    wheelTime = 0;
+#if KEYBOARD_SOF_ALIGNED
+    lastPoll = 0;
+    loadedAt = 1;
+    lastService = 0;
+    hostInterval = 0;
+    intervalPolls = 0;
+    txPending = false;
+    lastToken = usbTxBuf1[0];
+#endif
+
+    queueHead = 0;
+    queueTail = 0;
+    eventHead = eventTail;  // the poster owns eventTail
+    idleRepeat = 0;
+#ifdef USB_HOST_SIM
+    crcHits = 0;
+    crcMisses = 0;
+#endif
+
+    // Start out with all keys released.
+#if KEYBOARD_NKRO
+    memset(queuedReports, 0, sizeof(queuedReports));
+    for (uint8_t i = 0; i < KEYBOARD_REPORTS; i++) {
+      queuedReports[i][0] = i + 1;
+    }
+    memset(keyBits, 0, sizeof(keyBits));
+#else
+    memset(lastReport(1), 0, REPORT_LENGTH);
+    lastReport(1)[0] = 1;
+#endif
+    memset(consumerReport, 0, sizeof(consumerReport));
+    consumerReport[0] = CONSUMER_REPORT_ID;
+    consumerPending = 0;
+    consumerHeld = false;
+    consumerTurn = false;
+  }
+
+  // Takes an event from the free list and puts it into the wheel, due
+  // delayMs frames from now but not before the next frame.
+  uchar addEvent(uint16_t delayMs, uchar action) {
+    uchar event = freeEvent;
+
+    updateClock();
+    if (event != SCHEDULE_NONE) {
+      freeEvent = events[event].next;
+      events[event].due = frameClock + (delayMs != 0 ? delayMs : 1);
+      events[event].action = action;
+      linkEvent(event);
+    }
+    return event;
+  }
+
+  void linkEvent(uchar event) {
+    uchar slot = events[event].due & (SCHEDULE_WHEEL_SLOTS - 1);
+
+    events[event].next = wheel[slot];
+    wheel[slot] = event;
+  }
+
+#if KEYBOARD_SOF_ALIGNED
+  // Follows the host's polls of endpoint 1. A packet loaded since the last
+  // look has a new DATA token; once it has gone, the host collected it in
+  // this frame. A packet loaded in the frame of the previous collection is
+  // collected at the very next poll, so that gap is the host's poll period.
+  // The period is learned again every 16 polls, and a collection off the
+  // predicted polls, one that empties the queue or a late update() drop
+  // back to publishing at once until it is.
+  void trackHostPoll() {
+    uchar token = usbTxBuf1[0];
+
+    if (token != lastToken) {
+      lastToken = token;
+      loadedAt = frameClock;
+      txPending = true;
+    }
+    if (txPending && usbInterruptIsReady()) {
+      uint16_t gap = frameClock - lastPoll;
+
+      if (loadedAt == lastPoll) {
+        hostInterval = gap;
+        intervalPolls = 16;
+      } else if (hostInterval != 0 &&
+                 (gap % hostInterval != 0 || --intervalPolls == 0)) {
+        hostInterval = 0;
+      }
+      if (queueHead == queueTail) {
+        hostInterval = 0;
+      }
+      lastPoll = frameClock;
+      txPending = false;
+    }
+    serviceLate = (uint16_t)(frameClock - lastService) > 1;
+    lastService = frameClock;
+  }
+
+  // True in the frame before a predicted poll, and whenever the prediction
+  // cannot be trusted: no period known yet or update() skipped a frame.
+  bool publishDue() {
+    return hostInterval <= 1 || serviceLate ||
+           (uint16_t)(frameClock - lastPoll) % hostInterval == hostInterval - 1;
+  }
+
+#endif
+
+  void updateClock() {
+#if USB_COUNT_SOF
+    uchar sof = usbSofCount;
+
+    frameClock += (uchar)(sof - lastSof);
+    lastSof = sof;
+#else
+    frameClock = millis();
+#endif
+  }
+
+  // Advances the frame clock and runs the events of every frame it passed.
+  void runSchedule() {
+    updateClock();
+    while (wheelTime != frameClock) {
+      wheelTime++;
+
+      uchar slot = wheelTime & (SCHEDULE_WHEEL_SLOTS - 1);
+      uchar event = wheel[slot];
+
+      // Events due in a later turn of the wheel go back into the slot.
+      wheel[slot] = SCHEDULE_NONE;
+      while (event != SCHEDULE_NONE) {
+        ScheduledEvent *e = &events[event];
+        uchar next = e->next;
+
+        if (e->due != wheelTime) {
+          linkEvent(event);
+        } else if (!runEvent(e)) {
+          e->due++;     // no room in the queue, try again next frame
+          linkEvent(event);
+        } else {
+          e->next = freeEvent;
+          freeEvent = event;
+        }
+        event = next;
+      }
+    }
+  }
+
+  // Returns false if the event has to wait for room in the queue.
+  bool runEvent(ScheduledEvent *e) {
+    switch (e->action) {
+    case SCHEDULE_CALL:
+      e->callback(e->arg);
+      return true;
+    case SCHEDULE_RELEASE:
+      if (queueSpace() < KEYBOARD_REPORTS) {
+        return false;
+      }
+      queueReport(0, 0);
+      return true;
+    default: // SCHEDULE_TEXT
+      if (pacedLeft == 0) {
+        return true;
+      }
+      uint16_t index;
+      uint8_t  size = utf8Index(pacedText, pacedLeft, &index);
+
+      if (size == 0) {
+        pacedLeft = 0;    // the text ends inside a character
+        return true;
+      }
+      // Skipped here: alone, a malformed lead byte looks cut off to sendText().
+      if (index != LAYOUT_NONE && sendText(pacedText, size) == 0) {
+        return false;
+      }
+      pacedText += size;
+      pacedLeft -= size;
+      if (pacedLeft != 0) {
+        addEvent(pacedInterval, SCHEDULE_TEXT);
+      }
+      return true;
+    }
+  }
+
+  void attach() {
+    usbDeviceConnect();
+    USB_INTR_PENDING = 1 << USB_INTR_PENDING_BIT; // ignore edges from before
+    USB_INTR_ENABLE |= 1 << USB_INTR_ENABLE_BIT;
+    connecting = false;
+  }
+
+  // The USB interrupt must be off while detached, see usbDeviceDisconnect().
+  void detach() {
+    USB_INTR_ENABLE &= ~(1 << USB_INTR_ENABLE_BIT);
+    usbDeviceDisconnect();
+    usbConfiguration = 0;
+  }
+
+  // Hands the keyboard report in the transmit buffer to the driver, with
+  // the CRC from reportCrcCache if it is in there.
+  void commitReport() {
+#if REPORT_CRC_CACHE && !KEYBOARD_NKRO
+    const uchar *report = usbInterruptBuffer();
+    uint8_t key = report[2];
+    bool cached = report[1] == 0 || report[1] == MOD_SHIFT_LEFT;
+
+    if (key != 0) {
+      key -= CRC_CACHE_FIRST_KEY - 1;
+      cached = cached && key >= 1 && key < CRC_CACHE_ENTRIES;
+    }
+    for (uint8_t i = 3; cached && i < REPORT_LENGTH; i++) {
+      cached = report[i] == 0;
+    }
+    if (cached) {
+#ifdef USB_HOST_SIM
+      crcHits++;
+#endif
+      usbCommitInterruptCrc(REPORT_LENGTH,
+          pgm_read_word(&reportCrcCache[report[1] != 0][key]));
+      return;
+    }
+#endif
+#ifdef USB_HOST_SIM
+    crcMisses++;
+#endif
+    usbCommitInterrupt(REPORT_LENGTH);
+  }
+
+  void queueReport(uint8_t modifiers, uint8_t keyStroke) {
+    uchar state[BUFFER_SIZE] = { modifiers, keyStroke };
+
+    queueState(state);
+  }
+
+  // Queues the reports for a key state given as a modifier byte followed
+  // by BUFFER_SIZE-1 key slots, which is report 1 itself without NKRO.
+  // The caller makes sure there is room for KEYBOARD_REPORTS reports.
+  void queueState(const uchar *state) {
+#if KEYBOARD_NKRO
+    uchar bits[NKRO_STATE_SIZE];
+
+    memset(bits, 0, sizeof(bits));
+    bits[0] = state[0];
+    for (uint8_t i = 1; i < BUFFER_SIZE; i++) {
+      uint8_t index, mask;
+
+      if (usageBit(state[i], &index, &mask)) {
+        bits[index] |= mask;
+      }
+    }
+    queueBits(bits);
+#else
+    uchar *report = reportQueue[queueTail & (REPORT_QUEUE_SIZE - 1)];
+
+    report[0] = 1;
+    memcpy(report + 1, state, BUFFER_SIZE);
+    queueTail++;
+#endif
+  }
+
+  // Applies the events postKey() left in the ring as long as there is
+  // room in the report queue.
+  void applyKeyEvents() {
+    uchar head = eventHead;
+
+    while (head != RING_LOAD(eventTail)) {
+      const uchar *event = keyEvents[head & (KEY_EVENT_QUEUE_SIZE - 1)];
+      uchar state[KEY_STATE_SIZE];
+
+      keyState(state);
+      if (changeKey(state, event[0], event[1]) && !queueKeyState(state)) {
+        return;   // queue full, try again in the next update()
+      }
+      RING_STORE(eventHead, ++head);
+    }
+  }
+
+  // Copies the current key state, the modifier byte followed by the key
+  // slots or the bitmap of the reports queued last.
+  void keyState(uchar *state) {
+#if KEYBOARD_NKRO
+    for (uint8_t i = 0; i < KEYBOARD_REPORTS; i++) {
+      memcpy(state + i * (REPORT_LENGTH - 1), queuedReports[i] + 1, REPORT_LENGTH - 1);
+    }
+#else
+    memcpy(state, lastReport(1) + 1, BUFFER_SIZE);
+#endif
+  }
+
+  // Queues a key state unless it is the current one. Returns 0 if there is
+  // no room for it.
+  uint8_t queueKeyState(const uchar *state) {
+    uchar current[KEY_STATE_SIZE];
+
+    keyState(current);
+    if (memcmp(state, current, KEY_STATE_SIZE) == 0) {
+      return 1;
+    }
+    if (queueSpace() < KEYBOARD_REPORTS) {
+      return 0;
+    }
+#if KEYBOARD_NKRO
+    queueBits(state);
+#else
+    queueState(state);
+#endif
+    return 1;
+  }
+
+  // Presses or releases a key or modifier usage in a key state. The keys
+  // of an array state stay packed at the front in the order they went
+  // down. Returns false if a key to press has no free slot or bit.
+  static bool changeKey(uchar *state, uint8_t key, bool down) {
+#if KEYBOARD_NKRO
+    uint8_t index, mask;
+
+    if (!usageBit(key, &index, &mask)) {
+      return false;
+    }
+    state[index] = down ? state[index] | mask : state[index] & ~mask;
+    return true;
+#else
+    if (key >= 0xe0 && key <= 0xe7) {
+      uint8_t mask = 1 << (key - 0xe0);
+
+      state[0] = down ? state[0] | mask : state[0] & ~mask;
+      return true;
+    }
+    if (key == 0) {
+      return false;
+    }
+    for (uint8_t i = 1; i < BUFFER_SIZE; i++) {
+      if (state[i] == key) {
+        if (!down) {
+          memmove(state + i, state + i + 1, BUFFER_SIZE - 1 - i);
+          state[BUFFER_SIZE - 1] = 0;
+        }
+        return true;
+      }
+      if (state[i] == 0) {
+        state[i] = down ? key : 0;
+        return true;
+      }
+    }
+    return !down;
+#endif
+  }
+
+  // Releases the consumer usage that is down, otherwise presses the
+  // pending one.
+  void sendConsumerReport() {
+    uint16_t usage = 0;
+
+    if (!consumerHeld) {
+      usage = consumerPending;
+      consumerPending = 0;
+    }
+    consumerHeld = usage != 0;
+    consumerReport[1] = usage & 0xff;
+    consumerReport[2] = usage >> 8;
+#if KEYBOARD_CONSUMER_EP3
+    memcpy(usbInterruptBuffer3(), consumerReport, CONSUMER_REPORT_LENGTH);
+    usbCommitInterrupt3(CONSUMER_REPORT_LENGTH);
+#else
+    memcpy(usbInterruptBuffer(), consumerReport, CONSUMER_REPORT_LENGTH);
+    usbCommitInterrupt(CONSUMER_REPORT_LENGTH);
+#endif
+  }
+
+  // A key can join the keys in state[1] to state[slot-1] if the host will
+  // still see them go down in slot order. A bitmap report loses the slot
+  // order: the host scans it by usage and report 1 is sent before report 2,
+  // so in NKRO mode the keys of one state must be in ascending usage order.
+  static bool keyFits(const uchar *state, uint8_t slot, uint8_t key) {
+#if KEYBOARD_NKRO
+    return slot == 1 || key > state[slot - 1];
+#else
+    for (uint8_t i = 1; i < slot; i++) {
+      if (state[i] == key) {
+        return false;
+      }
+    }
+    return true;
+#endif
+  }
+
+#if KEYBOARD_NKRO
+  // Locates the bit of a usage in the bitmap state. Returns false if the
+  // bitmap has no bit for it.
+  static bool usageBit(uint8_t usage, uint8_t *index, uint8_t *mask) {
+    if (usage >= 0xe0 && usage <= 0xe7) {
+      *index = 0;
+      *mask = 1 << (usage - 0xe0);
+      return true;
+    }
+    if (usage < NKRO_FIRST_USAGE || usage > NKRO_LAST_USAGE) {
+      return false;
+    }
+    usage -= NKRO_FIRST_USAGE;
+    *index = 1 + (usage >> 3);
+    *mask = 1 << (usage & 7);
+    return true;
+  }
+
+  // Queues every report whose slice of the bitmap differs from the state
+  // queued last, in report ID order.
+  void queueBits(const uchar *bits) {
+    for (uint8_t i = 0; i < KEYBOARD_REPORTS; i++) {
+      const uchar *slice = bits + i * (REPORT_LENGTH - 1);
+      uchar *queued = queuedReports[i];
+
+      if (memcmp(slice, queued + 1, REPORT_LENGTH - 1) != 0) {
+        memcpy(queued + 1, slice, REPORT_LENGTH - 1);
+        memcpy(reportQueue[queueTail & (REPORT_QUEUE_SIZE - 1)], queued, REPORT_LENGTH);
+        queueTail++;
+      }
+    }
+  }
+#endif
+
+#if !KEYBOARD_NKRO
+  // States queued while the endpoint was busy are merged when the host can
+  // go straight from the state last sent to the one after the queued state
+  // and still see the same key-downs in the same order. That holds if every
+  // key or modifier the queued state presses is still down in the next one,
+  // its keys ahead of the keys the next one adds, no key it releases is
+  // down again and the modifiers do not change in a report with new keys.
+  // A press followed by its release thus stays two reports. Bitmap states
+  // are all sent.
+  bool stateRedundant(const uchar *state, const uchar *last) {
+    const uchar *next = reportQueue[queueHead & (REPORT_QUEUE_SIZE - 1)];
+    bool added = false;   // next has a new key of its own in an earlier slot
+    bool pressed = false; // some key goes down in the merged report
+
+    if (queueHead == queueTail || last[0] != 1 ||
+        (state[1] & ~last[1] & ~next[1]) != 0 ||  // pressed and released
+        (last[1] & ~state[1] & next[1]) != 0) {   // released and pressed again
+      return false;
+    }
+    for (uint8_t i = 2; i < REPORT_LENGTH; i++) {
+      uint8_t key = next[i];
+      bool    wasDown, inState;
+
+      if (key == 0) {
+        continue;
+      }
+      wasDown = reportHasKey(last + 1, key);
+      inState = reportHasKey(state + 1, key);
+      if (wasDown && !inState) {
+        return false;   // released by state, pressed again by next
+      }
+      if (!wasDown && !inState) {
+        added = true;
+      } else if (!wasDown && added) {
+        return false;   // pressed by state after a key of next
+      }
+      pressed |= !wasDown;
+    }
+    for (uint8_t i = 2; i < REPORT_LENGTH; i++) {
+      uint8_t key = state[i];
+
+      if (key != 0 && !reportHasKey(last + 1, key) &&
+          !reportHasKey(next + 1, key)) {
+        return false;   // pressed by state, released by next
+      }
+    }
+    return !pressed || last[1] == next[1];
+  }
+#endif
+
+  static uint8_t asciiToKey(char c) {
+    return (uint8_t)c < 128 ? pgm_read_byte(&asciiToKeyMap[(uint8_t)c]) : 0;
+  }
+
+  // Decodes the UTF-8 character at text into its index in the layout
+  // tables (see usb_layouts.h) and returns its length in bytes, 0 if the
+  // len bytes end inside it. Characters no table has, like all beyond
+  // Latin-1 but the euro sign, get LAYOUT_NONE; so do malformed bytes,
+  // which are skipped one by one.
+  static uint8_t utf8Index(const char *text, uint16_t len, uint16_t *index) {
+    uint8_t  lead = text[0], size;
+    uint16_t point;
+
+    *index = LAYOUT_NONE;
+    if (lead < 0x80) {
+      *index = lead;
+      return 1;
+    }
+    if (lead >= 0xc2 && lead <= 0xdf) {
+      size = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+      size = 3;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+      size = 4;
+    } else {
+      return 1;
+    }
+    point = lead & (0x7f >> size);
+    for (uint8_t i = 1; i < size; i++) {
+      if (i >= len) {
+        return 0;
+      }
+      if (((uint8_t)text[i] & 0xc0) != 0x80) {
+        return 1;
+      }
+      point = (point << 6) | (text[i] & 0x3f);
+    }
+    if (size == 2 && point >= 0xa0 && point <= 0xff) {
+      *index = point;     // 0x80-0x9f are C1 controls, 0x80 holds the euro
+    } else if (size == 3 && point == 0x20ac) {
+      *index = LAYOUT_EURO;
+    }
+    return size;
+  }
+
+  // The current layout's entry at a table index, see usb_layouts.h.
+  uint16_t layoutEntry(uint16_t index) {
+    switch (textLayout) {
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_UK)
+    case LAYOUT_UK:
+      return pgm_read_word(&layoutUK[index]);
+#endif
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_DE)
+    case LAYOUT_DE:
+      return pgm_read_word(&layoutDE[index]);
+#endif
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_FR)
+    case LAYOUT_FR:
+      return pgm_read_word(&layoutFR[index]);
+#endif
+    default: {  // LAYOUT_US
+      uint8_t code = index < 128 ? asciiToKey(index) : 0;
+
+      return (code & ~ASCII_SHIFT) | ((code & ASCII_SHIFT) ? LAYOUT_SHIFT : 0);
+    }
+    }
+  }
+
+  // Looks up the UTF-8 character at text, see utf8Index().
+  uint8_t textEntry(const char *text, uint16_t len, uint16_t *entry) {
+    uint16_t index;
+    uint8_t  size = utf8Index(text, len, &index);
+
+    *entry = layoutEntry(index);
+    return size;
+  }
+
+  static uint8_t layoutModifiers(uint16_t entry) {
+    return ((entry & LAYOUT_SHIFT) ? MOD_SHIFT_LEFT : 0) |
+           ((entry & LAYOUT_ALTGR) ? MOD_ALT_RIGHT : 0);
+  }
+
+  static bool reportHasKey(const uchar *report, uint8_t key) {
+    for (uint8_t i = 1; i < BUFFER_SIZE; i++) {
+      if (report[i] == key) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool     running;             // between begin() and end()
+  bool     connecting;          // detached, waiting for disconnectInterval
+  uint16_t connectStamp;        // millis() when the device was detached
+  uint16_t disconnectInterval;  // ms to stay detached
+
+  uint16_t frameClock;  // frames() for the scheduler
+  uint16_t wheelTime;   // last frame the wheel has been run for
+#if USB_COUNT_SOF
+  uchar    lastSof;     // usbSofCount at the last update
+#endif
+#if KEYBOARD_SOF_ALIGNED
+  uint16_t lastPoll;      // frame the host last collected a report in
+  uint16_t loadedAt;      // frame the pending packet was loaded in
+  uint16_t hostInterval;  // learned poll period, 0 if unknown
+  uchar    intervalPolls; // polls left until it is learned again
+  uint16_t lastService;   // frame of the previous update()
+  uchar    lastToken;     // DATA token of the last packet seen loaded
+  bool     txPending;     // that packet has not been collected yet
+  bool     serviceLate;   // update() skipped a frame before this one
+#endif
+  uchar    wheel[SCHEDULE_WHEEL_SLOTS];  // first event of each slot
+  uchar    freeEvent;   // first unused event
+  ScheduledEvent events[SCHEDULE_SIZE];
+  uint8_t  textLayout;  // LAYOUT_* sendText() types with
+  uint16_t writeTimeout; // ms write() waits for the host
+  const char *pacedText; // rest of the sendTextPaced() text
+  uint16_t pacedLeft;
+  uint16_t pacedInterval;
+
+  // Reports waiting for the interrupt endpoint. The indices run freely
+  // and are masked on access, so (queueTail - queueHead) is the fill level.
+  uchar    reportQueue[REPORT_QUEUE_SIZE][REPORT_LENGTH];
+  uchar    queueHead;
+  uchar    queueTail;
+
+  // Key events from postKey(). Only postKey() writes eventTail and only
+  // update() writes eventHead, see RING_LOAD().
+  uchar    keyEvents[KEY_EVENT_QUEUE_SIZE][2]; // [ usage, down ]
+  uchar    eventHead;
+  uchar    eventTail;
+
+  uint16_t idleStamp;   // frames() when a report was last sent
+  uchar    idleRepeat;  // reports left to repeat for the idle rate
+
+#ifdef USB_HOST_SIM
+  uint32_t crcHits;
+  uint32_t crcMisses;
+#endif
+
+  uint16_t consumerPending; // consumer usage waiting to be pressed, 0 if none
+  uchar    consumerReport[CONSUMER_REPORT_LENGTH]; // current consumer report [ report ID + 16 bit usage]
+  bool     consumerHeld;    // consumerReport has a usage down
+  bool     consumerTurn;    // consumer slot goes before the keyboard queue on endpoint 1
+
+#if KEYBOARD_NKRO
+  uchar    keyBits[NKRO_STATE_SIZE];    // pending state for sendKeyBits()
+  uchar    queuedReports[KEYBOARD_REPORTS][REPORT_LENGTH]; // last queued report per ID [ ID + 7 bitmap bytes]
+#endif
 };
 
 UsbKeyboardDevice UsbKeyboard = UsbKeyboardDevice();
 
+#if USB_POLL_TIMER
+// ISR_NOBLOCK enables interrupts again as the first instruction, so the
+// USB interrupt is never delayed by more than a few cycles. A compare match
+// during a long service() must not start a second one.
+ISR(TIMER2_COMPA_vect, ISR_NOBLOCK) {
+  static volatile bool busy;
+
+  if (!busy) {
+    busy = true;
+    UsbKeyboard.service();
+    busy = false;
+  }
+}
+#endif
+
 #ifdef __cplusplus
 extern "C"{
 #endif 
@@ -404,29 +1974,55 @@ uchar usbFunctionSetup(uchar data[8])
   {
     usbRequest_t    *rq = (usbRequest_t *)((void *)data);
 
-    usbMsgPtr = UsbKeyboard.reportBuffer; //
+    usbMsgPtr = UsbKeyboard.lastReport(1); //
     if((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS){
       /* class request type */
 
       if(rq->bRequest == USBRQ_HID_GET_REPORT){
 	/* wValue: ReportType (highbyte), ReportID (lowbyte) */
 
-	/* we only have one report type, so don't look at wValue */
-        // TODO: Ensure it's okay not to return anything here?    
-	return 0;
+	/* we only have input reports, so only look at the report ID */
+	/* the current report is read in place from the queue */
+	usbMsgPtr = UsbKeyboard.lastReport(rq->wValue.bytes[0]);
+	return UsbKeyboard.reportLength(rq->wValue.bytes[0]);
 
       }else if(rq->bRequest == USBRQ_HID_GET_IDLE){
-	//            usbMsgPtr = &idleRate;
-	//            return 1;
-	return 0;
+	usbMsgPtr = &idleRate;
+	return 1;
       }else if(rq->bRequest == USBRQ_HID_SET_IDLE){
-	idleRate = rq->wValue.bytes[1];
+	/* the consumer interface does not repeat reports, ignore it */
+	if(rq->wIndex.bytes[0] == KEYBOARD_INTERFACE){
+	  idleRate = rq->wValue.bytes[1];
+	}
       }
     }else{
       /* no vendor specific requests implemented */
     }
     return 0;
   }
+
+#if KEYBOARD_CONSUMER_EP3
+/* The driver serves a single HID and report descriptor, with two interfaces
+ * they are looked up here by the interface number in wIndex.
+ */
+usbMsgLen_t usbFunctionDescriptor(struct usbRequest *rq)
+  {
+    uchar consumer = rq->wIndex.bytes[0] == CONSUMER_INTERFACE;
+
+    if(rq->wValue.bytes[1] == USBDESCR_HID){
+      usbMsgPtr = (usbMsgPtr_t)(usbDescriptorConfiguration + (consumer ? 43 : 18));
+      return 9;
+    }else if(rq->wValue.bytes[1] == USBDESCR_HID_REPORT){
+      if(consumer){
+	usbMsgPtr = (usbMsgPtr_t)(usbHidReportDescriptor + KEYBOARD_DESCRIPTOR_LENGTH);
+	return CONSUMER_DESCRIPTOR_LENGTH;
+      }
+      usbMsgPtr = (usbMsgPtr_t)usbHidReportDescriptor;
+      return KEYBOARD_DESCRIPTOR_LENGTH;
+    }
+    return 0;
+  }
+#endif
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -4,13 +4,25 @@
 
 // If the timer isr is corrected
 // to not take so long change this to 0.
+// Building with USB_POLL_TIMER 1 (define it before including
+// UsbKeyboard.h) services USB from Timer2 and makes this unnecessary.
+// Without Timer0 millis() stands still, so this sketch must not use
+// UsbKeyboard.print(): it would wait forever once the host stops polling.
 #define BYPASS_TIMER_ISR 1
 
 void setup() {
+  // Enumeration runs in the background while the rest is set up.
+  UsbKeyboard.begin();
+
   pinMode(BUTTON_PIN, INPUT);
   digitalWrite(BUTTON_PIN, HIGH);
   
 #if BYPASS_TIMER_ISR
+  // begin() times the disconnect interval with millis().
+  while (!UsbKeyboard.isAttached()) {
+    UsbKeyboard.update();
+  }
+
   // disable timer 0 overflow interrupt (used for millis)
   TIMSK0&=!(1<<TOIE0); // ++
 #endif
@@ -26,6 +38,13 @@ void delayMs(unsigned int ms) {
 }
 #endif
 
+// Queue a keystroke, servicing the USB driver until there is room for it.
+void typeKey(uint8_t key) {
+  while (!UsbKeyboard.sendKeyStroke(key)) {
+    UsbKeyboard.update();
+  }
+}
+
 void loop() {
   uint32_t printLine;
   
@@ -39,22 +58,27 @@ void loop() {
     printLine++;
     //UsbKeyboard.sendKeyStroke(KEY_B, MOD_GUI_LEFT);
     
-    UsbKeyboard.sendKeyStroke(KEY_H);
-    UsbKeyboard.sendKeyStroke(KEY_E);
-    UsbKeyboard.sendKeyStroke(KEY_L);
-    UsbKeyboard.sendKeyStroke(KEY_L);
-    UsbKeyboard.sendKeyStroke(KEY_O);
-
-    UsbKeyboard.sendKeyStroke(KEY_SPACE);
-
-    UsbKeyboard.sendKeyStroke(KEY_W);
-    UsbKeyboard.sendKeyStroke(KEY_O);
-    UsbKeyboard.sendKeyStroke(KEY_R);
-    UsbKeyboard.sendKeyStroke(KEY_L);
-    UsbKeyboard.sendKeyStroke(KEY_D);
+    typeKey(KEY_H);
+    typeKey(KEY_E);
+    typeKey(KEY_L);
+    typeKey(KEY_L);
+    typeKey(KEY_O);
+
+    typeKey(KEY_SPACE);
+
+    typeKey(KEY_W);
+    typeKey(KEY_O);
+    typeKey(KEY_R);
+    typeKey(KEY_L);
+    typeKey(KEY_D);
     //UsbKeyboard.sendKeyStroke(KEY_B, MOD_GUI_LEFT);
 
-    UsbKeyboard.sendKeyStroke(KEY_ENTER);
+    typeKey(KEY_ENTER);
+
+    // Let the rest of the queue go out before we sleep.
+    while (!UsbKeyboard.queueEmpty()) {
+      UsbKeyboard.update();
+    }
 #if BYPASS_TIMER_ISR  // check if timer isr fixed.
     delayMs(20);
 #else
@@ -0,0 +1,726 @@
+//*****************************************************************************
+//*     Receiver Cycle Budget Check                                           *
+//*****************************************************************************
+//
+//      Static timing analysis of the software receiver in usbdrvasm*.inc.
+//      Reads one clock variant after the C preprocessor (see cycles.sh),
+//      assigns every instruction its cycle count on the classic AVR core,
+//      builds the control flow graph and computes, for every sample point,
+//      the shortest and longest path to each sample point that can follow
+//      it. A sample point is an instruction that reads USBIN (in, sbis,
+//      sbic) from haveTwoBitsK on; the sync pattern search before it
+//      follows the edges. Reads commented as "phase", which the 12.8 and
+//      16.5 MHz variants use to track the bit phase, and the SE0 check of
+//      the other line right after a sample are not sample points.
+//
+//      The bit time is clock / 1.5 MHz cycles. A path is within budget if
+//      it takes the bit time rounded down or up, or twice the bit time
+//      where a stuffed bit is skipped, plus or minus the slack given with
+//      -s (default 0). The variants deliberately sample early or late in
+//      places, and those with a fractional bit time correct the phase by
+//      leap cycles; the budget file given with -b (budget.txt) lists these
+//      sample points with the cycles their paths may take. Sample points
+//      are named after the label before them, "rxbit1+0" is the first one
+//      at or after rxbit1. Paths that reach no further sample point (end
+//      of packet) are not checked, loops between two are reported.
+//
+//      One JSON object is printed with the number of sample points and the
+//      range of path lengths, and every violation is printed on stderr;
+//      -v lists the offending path. The exit status is non-zero if the
+//      budget is broken.
+//
+//      Build and run from this directory:
+//
+//        g++ -O2 -o cycles cycles.cpp
+//        cpp -x assembler-with-cpp -I../.. ../../usbdrvasm16.inc |
+//            ./cycles -c 16000 -b budget.txt
+//
+//      cycles.sh does this for every clock rate usbdrvasm.S supports.
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_LINES       4096
+#define MAX_INSNS       4096
+#define MAX_LABELS      512
+#define MAX_MACROS      16
+#define MAX_EXCEPTIONS  64
+#define NAME_SIZE       32
+
+struct Line {
+  char  text[160];
+  char  path[128];
+  int   line;
+};
+
+struct Insn {
+  char        mnemonic[NAME_SIZE];
+  char        target[NAME_SIZE];  // branch, jump or call target
+  const Line *source;
+  int         words;
+  bool        sample;
+  int         jump;               // index of the target, -1 if none
+};
+
+struct Label {
+  char  name[NAME_SIZE];
+  int   insn;
+};
+
+struct Macro {
+  char  name[NAME_SIZE];
+  int   first, last;              // body lines
+};
+
+static Line   lines[MAX_LINES];
+static int    lineCount;
+static Insn   insns[MAX_INSNS];
+static int    insnCount;
+static Label  labels[MAX_LABELS];
+static int    labelCount;
+static Macro  macros[MAX_MACROS];
+static int    macroCount;
+
+// --- PARSER -----------------------------------------------------------------
+
+static bool readLines(FILE *in) {
+  char buf[512], path[128] = "?";
+  int  line = 0;
+
+  while (fgets(buf, sizeof(buf), in)) {
+    // Line markers of the preprocessor: # 123 "file"
+    if (buf[0] == '#') {
+      char *quote = strchr(buf, '"');
+
+      line = atoi(buf + 1) - 1;
+      if (quote) {
+        snprintf(path, sizeof(path), "%s", quote + 1);
+        path[strcspn(path, "\"")] = 0;
+      }
+      continue;
+    }
+    line++;
+    if (lineCount == MAX_LINES) {
+      fprintf(stderr, "too many lines\n");
+      return false;
+    }
+    Line *l = &lines[lineCount++];
+    snprintf(l->text, sizeof(l->text), "%.159s", buf);
+    snprintf(l->path, sizeof(l->path), "%s", path);
+    l->line = line;
+  }
+  return true;
+}
+
+static const char *fileName(const Line *l) {
+  const char *base = strrchr(l->path, '/');
+
+  return base ? base + 1 : l->path;
+}
+
+// The preprocessor expands register names in the ';' comments too, so the
+// comment is taken from the source file.
+static bool sourceComment(const Line *l, char *comment, size_t size) {
+  FILE *f = fopen(l->path, "r");
+  char  buf[256];
+  bool  found = false;
+
+  comment[0] = 0;
+  for (int n = 1; f != NULL && fgets(buf, sizeof(buf), f); n++) {
+    if (n == l->line) {
+      const char *c = strchr(buf, ';');
+
+      snprintf(comment, size, "%s", c ? c : "");
+      found = true;
+      break;
+    }
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+  return found;
+}
+
+// Copies the next identifier-like token ([A-Za-z0-9_.$+-()]) from *p.
+static bool token(const char **p, char *out) {
+  const char *s = *p;
+  int n = 0;
+
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  while (*s && !isspace((unsigned char)*s) && *s != ',' && *s != ';' &&
+         n < NAME_SIZE - 1) {
+    out[n++] = *s++;
+  }
+  out[n] = 0;
+  *p = s;
+  return n != 0;
+}
+
+static Macro *findMacro(const char *name) {
+  for (int i = 0; i < macroCount; i++) {
+    if (strcmp(macros[i].name, name) == 0) {
+      return &macros[i];
+    }
+  }
+  return NULL;
+}
+
+static bool isBranch(const char *m) {
+  return m[0] == 'b' && m[1] == 'r';
+}
+
+static bool isSkip(const char *m) {
+  return !strcmp(m, "sbis") || !strcmp(m, "sbic") || !strcmp(m, "sbrs") ||
+         !strcmp(m, "sbrc") || !strcmp(m, "cpse");
+}
+
+static bool addInsn(const Line *l, const char *mnemonic, const char *operands) {
+  if (insnCount == MAX_INSNS) {
+    fprintf(stderr, "too many instructions\n");
+    return false;
+  }
+
+  Insn *insn = &insns[insnCount++];
+  char comment[160];
+
+  sourceComment(l, comment, sizeof(comment));
+  snprintf(insn->mnemonic, sizeof(insn->mnemonic), "%s", mnemonic);
+  insn->source = l;
+  insn->jump = -1;
+  insn->target[0] = 0;
+  insn->words = !strcmp(mnemonic, "lds") || !strcmp(mnemonic, "sts") ||
+                !strcmp(mnemonic, "jmp") || !strcmp(mnemonic, "call") ? 2 : 1;
+  insn->sample = (!strcmp(mnemonic, "in") || !strcmp(mnemonic, "sbis") ||
+                  !strcmp(mnemonic, "sbic")) && strstr(operands, "USBIN") &&
+                 !strstr(comment, "phase");
+
+  // The target is the last operand.
+  if (isBranch(mnemonic) || !strcmp(mnemonic, "rjmp") ||
+      !strcmp(mnemonic, "rcall") || !strcmp(mnemonic, "jmp")) {
+    const char *comma = strrchr(operands, ',');
+    const char *p = comma ? comma + 1 : operands;
+
+    token(&p, insn->target);
+  }
+  return true;
+}
+
+static bool parseLines(int first, int last, int depth) {
+  for (int i = first; i < last; i++) {
+    char text[160], word[NAME_SIZE];
+    const char *p = text;
+
+    snprintf(text, sizeof(text), "%s", lines[i].text);
+    text[strcspn(text, ";")] = 0;
+    if (!token(&p, word)) {
+      continue;
+    }
+    if (!strcmp(word, "macro")) {
+      Macro *m = &macros[macroCount < MAX_MACROS ? macroCount++ : MAX_MACROS - 1];
+
+      token(&p, m->name);
+      m->first = i + 1;
+      while (i < last && !strstr(lines[i].text, "endm")) {
+        i++;
+      }
+      m->last = i;
+      continue;
+    }
+
+    // Labels, possibly followed by an instruction.
+    size_t len = strlen(word);
+    if (word[len - 1] == ':' || *p == ':') {
+      if (depth == 0 && labelCount < MAX_LABELS) {
+        word[len - 1] = word[len - 1] == ':' ? 0 : word[len - 1];
+        snprintf(labels[labelCount].name, NAME_SIZE, "%s", word);
+        labels[labelCount++].insn = insnCount;
+      }
+      if (*p == ':') {
+        p++;
+      }
+      if (!token(&p, word)) {
+        continue;
+      }
+    }
+    if (word[0] == '.') {
+      continue;   // assembler directive or data
+    }
+
+    Macro *m = findMacro(word);
+    if (m != NULL) {
+      if (depth > 4 || !parseLines(m->first, m->last, depth + 1)) {
+        return false;
+      }
+      continue;
+    }
+
+    // Helper macros of usbdrvasm.S for I/O space addresses.
+    if (!strncmp(word, "USB_LOAD_PENDING", 16)) {
+      strcpy(word, "in");
+    } else if (!strncmp(word, "USB_STORE_PENDING", 17)) {
+      strcpy(word, "out");
+    }
+    if (!addInsn(&lines[i], word, p)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int findLabel(const char *name) {
+  for (int i = 0; i < labelCount; i++) {
+    if (strcmp(labels[i].name, name) == 0) {
+      return labels[i].insn;
+    }
+  }
+  return -1;
+}
+
+static bool resolveTargets(void) {
+  bool ok = true;
+
+  for (int i = 0; i < insnCount; i++) {
+    Insn *insn = &insns[i];
+
+    if (insn->target[0] == 0) {
+      continue;
+    }
+    // nop2 is "rjmp .+0" or "rjmp $+2", a jump to the next instruction.
+    if (!strcmp(insn->target, ".+0") || !strcmp(insn->target, "$+2")) {
+      insn->jump = i + 1;
+      continue;
+    }
+    insn->jump = findLabel(insn->target);
+    if (insn->jump < 0 && strcmp(insn->mnemonic, "rcall") != 0) {
+      fprintf(stderr, "%s:%d: unknown label %s\n", fileName(insn->source),
+              insn->source->line, insn->target);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// --- CYCLE COSTS ------------------------------------------------------------
+
+// Up to two successors of an instruction with the cycles it takes to get
+// there. Returns the number of successors; 0 ends the path (ret, reti).
+static int successors(int i, int next[2], int cycles[2]) {
+  Insn *insn = &insns[i];
+  const char *m = insn->mnemonic;
+
+  if (!strcmp(m, "nop2") || !strcmp(m, "rjmp")) {
+    next[0] = !strcmp(m, "nop2") ? i + 1 : insn->jump;
+    cycles[0] = 2;
+    return 1;
+  }
+  if (!strcmp(m, "ret") || !strcmp(m, "reti") || !strcmp(m, "ijmp") ||
+      !strcmp(m, "jmp")) {
+    return 0;
+  }
+  if (isBranch(m)) {
+    next[0] = i + 1;
+    cycles[0] = 1;
+    next[1] = insn->jump;
+    cycles[1] = 2;
+    return 2;
+  }
+  if (isSkip(m)) {
+    next[0] = i + 1;
+    cycles[0] = 1;
+    next[1] = i + 2;
+    cycles[1] = i + 1 < insnCount ? 1 + insns[i + 1].words : 2;
+    return 2;
+  }
+
+  int c = 1;
+  if (!strcmp(m, "push") || !strcmp(m, "pop") || !strcmp(m, "lds") ||
+      !strcmp(m, "sts") || !strncmp(m, "ld", 2) || !strncmp(m, "st", 2) ||
+      !strcmp(m, "adiw") || !strcmp(m, "sbiw") || !strcmp(m, "sbi") ||
+      !strcmp(m, "cbi") || !strncmp(m, "mul", 3)) {
+    c = 2;
+  } else if (!strcmp(m, "lpm")) {
+    c = 3;
+  } else if (!strcmp(m, "rcall")) {
+    c = 7;  // call and ret; the callee is not part of the receiver
+  }
+  next[0] = i + 1;
+  cycles[0] = c;
+  return 1;
+}
+
+// --- ANALYSIS ---------------------------------------------------------------
+
+// Path lengths are sets of cycles, bit n for n cycles. LONG stands for 63
+// cycles and more, which includes loops.
+typedef unsigned long long Lengths;
+
+#define LONG  (1ULL << 63)
+
+static Lengths  lengths[MAX_INSNS];
+static bool     looping[MAX_INSNS];
+static char     state[MAX_INSNS];  // 0 new, 1 on the current path, 2 done
+static int      receiverStart;     // haveTwoBitsK
+
+static Lengths later(Lengths l, int cycles) {
+  Lengths overflow = (l & ~LONG) >> (63 - cycles);
+
+  return ((l & ~LONG) << cycles) | (l & LONG) | (overflow ? LONG : 0);
+}
+
+// The cycles from the start of instruction i to the next sample point on
+// every path, 0 if no sample point follows.
+static void measure(int i) {
+  int next[2], cycles[2], n = successors(i, next, cycles);
+
+  state[i] = 1;
+  lengths[i] = looping[i] ? LONG : 0;
+  for (int k = 0; k < n; k++) {
+    int j = next[k];
+
+    if (j < receiverStart || j >= insnCount) {
+      continue;   // back to the sync pattern search: the packet ended
+    }
+    if (insns[j].sample) {
+      lengths[i] |= later(1, cycles[k]);
+      continue;
+    }
+    // A loop back to the current path is found by findLoops().
+    if (state[j] == 0) {
+      measure(j);
+    }
+    if (state[j] == 2) {
+      lengths[i] |= later(lengths[j], cycles[k]);
+    }
+  }
+  state[i] = 2;
+}
+
+static void measureAll(void) {
+  memset(state, 0, sizeof(state));
+  for (int i = receiverStart; i < insnCount; i++) {
+    if (state[i] == 0) {
+      measure(i);
+    }
+  }
+}
+
+// Marks every instruction on a loop that avoids sample points but leads to
+// one.
+static void findLoops(void) {
+  static int  stack[MAX_INSNS];
+  static char seen[MAX_INSNS];
+
+  for (int i = receiverStart; i < insnCount; i++) {
+    int top = 0;
+
+    if (insns[i].sample || lengths[i] == 0) {
+      continue;
+    }
+    memset(seen, 0, sizeof(seen));
+    stack[top++] = i;
+    while (top && !looping[i]) {
+      int j = stack[--top], next[2], cycles[2], n = successors(j, next, cycles);
+
+      for (int k = 0; k < n; k++) {
+        int t = next[k];
+
+        looping[i] |= t == i;
+        if (t >= receiverStart && t < insnCount && !seen[t] && !insns[t].sample) {
+          seen[t] = 1;
+          stack[top++] = t;
+        }
+      }
+    }
+  }
+}
+
+// Lists a path of the given cycles from the start of instruction i to the
+// next sample point, which is listed last.
+static bool printPath(int i, int cycles) {
+  int next[2], c[2], n;
+
+  if (insns[i].sample) {
+    const Line *l = insns[i].source;
+
+    fprintf(stderr, "    %s:%d:%s", fileName(l), l->line, l->text);
+    return cycles == 0;
+  }
+  n = successors(i, next, c);
+  for (int k = 0; k < n; k++) {
+    int j = next[k];
+
+    if (j >= receiverStart && j < insnCount && cycles >= c[k] &&
+        ((insns[j].sample && cycles == c[k]) ||
+         (!insns[j].sample && (lengths[j] >> (cycles - c[k]) & 1)))) {
+      const Line *l = insns[i].source;
+
+      fprintf(stderr, "    %s:%d:%s", fileName(l), l->line, l->text);
+      return printPath(j, cycles - c[k]);
+    }
+  }
+  return false;
+}
+
+// --- BUDGET -----------------------------------------------------------------
+
+// Deviations from the bit time the code makes on purpose, from the budget
+// file: clock, sample point, cycles, reason. The cycles are a list of
+// numbers and ranges, "8-10,19", the paths of the sample point may take
+// instead of the bit time.
+struct Exception {
+  char    sample[NAME_SIZE + 8];
+  Lengths allowed;
+  bool    used;
+};
+
+static Exception  exceptions[MAX_EXCEPTIONS];
+static int        exceptionCount;
+
+static bool parseLengths(const char *s, Lengths *l) {
+  *l = 0;
+  while (*s) {
+    char *end;
+    long low = strtol(s, &end, 10), high = low;
+
+    if (end == s) {
+      return false;
+    }
+    if (*end == '-') {
+      s = end + 1;
+      high = strtol(s, &end, 10);
+      if (end == s) {
+        return false;
+      }
+    }
+    for (long n = low; n <= high && n < 63; n++) {
+      *l |= 1ULL << n;
+    }
+    s = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool readBudget(const char *path, long clockKhz) {
+  FILE *f = fopen(path, "r");
+  char  buf[256], cycles[64];
+  int   line = 0;
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  while (fgets(buf, sizeof(buf), f)) {
+    Exception *e = &exceptions[exceptionCount];
+    long clock;
+
+    line++;
+    if (buf[0] == '#' ||
+        sscanf(buf, "%ld %39s %63s", &clock, e->sample, cycles) != 3 ||
+        clock != clockKhz) {
+      continue;
+    }
+    if (!parseLengths(cycles, &e->allowed) || exceptionCount == MAX_EXCEPTIONS) {
+      fprintf(stderr, "%s:%d: bad entry\n", path, line);
+      fclose(f);
+      return false;
+    }
+    e->used = false;
+    exceptionCount++;
+  }
+  fclose(f);
+  return true;
+}
+
+// Names sample point i after the label before it: "rxbit1+0" is the first
+// sample point at or after rxbit1.
+static void sampleName(int i, char *name, size_t size) {
+  int label = -1, n = 0;
+
+  for (int k = 0; k < labelCount; k++) {
+    if (labels[k].insn <= i) {
+      label = k;
+    }
+  }
+  for (int k = label < 0 ? 0 : labels[label].insn; k < i; k++) {
+    n += insns[k].sample;
+  }
+  snprintf(name, size, "%s+%d", label < 0 ? "?" : labels[label].name, n);
+}
+
+static Exception *findException(const char *name) {
+  for (int i = 0; i < exceptionCount; i++) {
+    if (strcmp(exceptions[i].sample, name) == 0) {
+      return &exceptions[i];
+    }
+  }
+  return NULL;
+}
+
+// Between two sample points is one bit time, or two if the receiver skips
+// a stuffed bit without sampling it.
+static Lengths bitTimes(double bit, int slack) {
+  Lengths l = 0;
+
+  for (int n = 1; n <= 2; n++) {
+    for (int c = (int)floor(n * bit) - slack; c <= (int)ceil(n * bit) + slack; c++) {
+      l |= c > 0 && c < 63 ? 1ULL << c : 0;
+    }
+  }
+  return l;
+}
+
+static void formatLengths(Lengths l, char *buf, size_t size) {
+  size_t len = 0;
+
+  buf[0] = 0;
+  for (int n = 0; n < 64 && len < size; n++) {
+    if (l >> n & 1) {
+      len += snprintf(buf + len, size - len, n == 63 ? "%s63+" : "%s%d",
+                      len ? " " : "", n);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *budget = NULL;
+  long  clockKhz = 0;
+  int   slack = 0, opt;
+  bool  verbose = false;
+
+  while ((opt = getopt(argc, argv, "b:c:s:v")) != -1) {
+    if (opt == 'b') {
+      budget = optarg;
+    } else if (opt == 'c') {
+      clockKhz = atol(optarg);
+    } else if (opt == 's') {
+      slack = atoi(optarg);
+    } else if (opt == 'v') {
+      verbose = true;
+    }
+  }
+  if (clockKhz <= 0) {
+    fprintf(stderr, "usage: %s -c KHZ [-b BUDGET] [-s SLACK] [-v] [FILE]\n", argv[0]);
+    return 2;
+  }
+  if (budget != NULL && !readBudget(budget, clockKhz)) {
+    return 2;
+  }
+
+  FILE *in = optind < argc ? fopen(argv[optind], "r") : stdin;
+  if (in == NULL) {
+    perror(argv[optind]);
+    return 2;
+  }
+  if (!readLines(in) || !parseLines(0, lineCount, 0) || !resolveTargets()) {
+    return 2;
+  }
+
+  int start = receiverStart = findLabel("haveTwoBitsK");
+  if (start < 0) {
+    fprintf(stderr, "no haveTwoBitsK label\n");
+    return 2;
+  }
+  // The sync pattern search before it is timed by the edges, not by the
+  // bit time; paths that return to it end the packet.
+  for (int i = 0; i < start; i++) {
+    insns[i].sample = false;
+  }
+  // A read of the other line right after a sample checks for SE0 in the
+  // same bit (12.8 MHz).
+  for (int i = insnCount - 1; i > start; i--) {
+    insns[i].sample &= !insns[i - 1].sample;
+  }
+  measureAll();
+  findLoops();
+  measureAll();
+
+  double  bit = clockKhz / 1500.0;
+  Lengths budgeted = bitTimes(bit, slack), all = 0;
+  int     samples = 0, violations = 0;
+
+  for (int i = start; i < insnCount; i++) {
+    char    name[NAME_SIZE + 8], list[256];
+    Lengths paths = 0, bad;
+
+    if (!insns[i].sample) {
+      continue;
+    }
+    samples++;
+    sampleName(i, name, sizeof(name));
+
+    // A sample point's paths start with its own cycles.
+    int next[2], cycles[2], n = successors(i, next, cycles);
+    for (int k = 0; k < n; k++) {
+      int j = next[k];
+
+      if (j >= start && j < insnCount) {
+        paths |= later(insns[j].sample ? 1 : lengths[j], cycles[k]);
+      }
+    }
+    all |= paths;
+
+    Exception *e = findException(name);
+    if (e != NULL) {
+      e->used = true;
+    }
+    bad = paths & ~(e != NULL ? e->allowed : budgeted);
+    if (bad == 0) {
+      continue;
+    }
+
+    const Line *s = insns[i].source;
+    violations++;
+    formatLengths(paths, list, sizeof(list));
+    fprintf(stderr, "%s:%d: %s: next sample point after %s cycles\n",
+            fileName(s), s->line, name, list);
+    if (verbose) {
+      int worst = 0;
+
+      while (!(bad >> worst & 1)) {
+        worst++;
+      }
+      fprintf(stderr, "  %d cycles:\n    %s:%d:%s", worst, fileName(s), s->line, s->text);
+      for (int k = 0; k < n; k++) {
+        int j = next[k];
+
+        if (j >= start && j < insnCount && worst >= cycles[k] &&
+            (insns[j].sample ? worst == cycles[k] : lengths[j] >> (worst - cycles[k]) & 1)) {
+          printPath(j, worst - cycles[k]);
+          break;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < exceptionCount; i++) {
+    if (!exceptions[i].used) {
+      fprintf(stderr, "%s: no sample point %s\n", budget, exceptions[i].sample);
+      violations++;
+    }
+  }
+
+  int shortest = 0, longest = 63;
+  while (shortest < 63 && !(all >> shortest & 1)) {
+    shortest++;
+  }
+  while (longest > 0 && !(all >> longest & 1)) {
+    longest--;
+  }
+  printf("{\"clock_khz\":%ld,\"cycles_per_bit\":%.3f,\"samples\":%d,"
+         "\"exceptions\":%d,\"min_cycles\":%d,\"max_cycles\":%d,"
+         "\"violations\":%d,\"ok\":%s}\n", clockKhz, bit, samples, exceptionCount,
+         shortest, longest == 63 ? -1 : longest, violations,
+         violations || !samples ? "false" : "true");
+  return violations != 0 || samples == 0;
+}
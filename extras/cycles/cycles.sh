@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Checks the cycle budget of the receiver (see cycles.cpp) for every clock
+# rate usbdrvasm.S includes a usbdrvasm*.inc for, so a new
+# USB_CFG_CLOCK_KHZ target is checked as soon as it is added there. Output
+# is one JSON object per clock rate on stdout, violations go to stderr, and
+# the exit status is non-zero if any variant breaks its budget, so it can
+# run as a build step:
+#
+#   extras/cycles/cycles.sh
+#
+# Deliberate deviations from the bit time are listed in budget.txt. Pass
+# -v to list the offending paths. Set CPP/CXX to use other tools and
+# CPPFLAGS to preprocess with the options of your usbconfig.h (e.g.
+# -DUSB_COUNT_SOF=1). The tool is built in $TMPDIR.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+LIB=$HERE/../..
+OUT=${TMPDIR:-/tmp}/usbkeyboard-cycles
+CPP=${CPP:-cpp}
+CXX=${CXX:-g++}
+
+mkdir -p "$OUT"
+$CXX -O2 -o "$OUT/cycles" "$HERE/cycles.cpp"
+
+# "clock file crc" for every include of the clock rate dispatcher.
+awk '
+    /^#if USB_CFG_CHECK_CRC/                    { crc = 1 }
+    /^#else/ && /USB_CFG_CHECK_CRC/             { crc = 0 }
+    /USB_CFG_CLOCK_KHZ == [0-9]+/               { match($0, /[0-9]+$/); clock = substr($0, RSTART) }
+    /#[ \t]*include "usbdrvasm[^"]*\.inc"/ && clock {
+        match($0, /usbdrvasm[^"]*\.inc/)
+        print clock, substr($0, RSTART, RLENGTH), crc
+        clock = ""
+    }
+' "$LIB/usbdrvasm.S" > "$OUT/variants"
+
+status=0
+while read clock file crc; do
+    $CPP -x assembler-with-cpp -DUSB_CFG_CLOCK_KHZ=$clock -DUSB_CFG_CHECK_CRC=$crc \
+        $CPPFLAGS -I"$LIB" "$LIB/$file" > "$OUT/$file.i"
+    "$OUT/cycles" -c $clock -b "$HERE/budget.txt" "$@" "$OUT/$file.i" || status=1
+done < "$OUT/variants"
+exit $status
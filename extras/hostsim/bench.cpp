@@ -0,0 +1,235 @@
+//*****************************************************************************
+//*     UsbKeyboard Typing Benchmark                                          *
+//*****************************************************************************
+//
+//      Types canned text corpora through each send strategy of
+//      UsbKeyboardDevice on the simulated bus (see usbhostsim.h) at interrupt
+//      poll intervals of 1, 2, 5 and 10 ms. The simulated host decodes the
+//      reports back into text, which must match the corpus.
+//
+//      One JSON object is printed per run with the characters per second,
+//      interrupt reports per character, the p50/p99 latency from enqueueing
+//      a character to the host receiving its key-down report, a histogram of
+//      that latency and how many report CRCs came from the CRC cache (hits)
+//      or were calculated.
+//
+//      BUFFER_SIZE, KEYBOARD_NKRO and KEYBOARD_SOF_ALIGNED are compile time
+//      settings; bench.sh builds and runs this file for every supported
+//      combination.
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "UsbKeyboard.h"
+#include "hostkeyboard.h"
+
+#define MAX_TEXT        1024
+
+// Upper bounds in ms of the latency histogram buckets, the last one is open.
+static const unsigned histogramBounds[] = { 5, 10, 20, 50, 100, 200 };
+#define HISTOGRAM_BUCKETS (sizeof(histogramBounds) / sizeof(histogramBounds[0]) + 1)
+
+// --- CORPORA ----------------------------------------------------------------
+
+struct Corpus {
+  const char *name;
+  const char *text;
+};
+
+static const Corpus corpora[] = {
+  { "prose",
+    "It was the best of times, it was the worst of times, it was the age "
+    "of wisdom, it was the age of foolishness, it was the epoch of belief, "
+    "it was the epoch of incredulity, it was the season of Light, it was "
+    "the season of Darkness, it was the spring of hope, it was the winter "
+    "of despair.\n" },
+  { "code",
+    "for (uint8_t i = 0; i < size; i++) {\n"
+    "\tif (buffer[i] != 0x00 && (mask & (1 << i))) {\n"
+    "\t\ttotal += buffer[i] * 2; // accumulate\n"
+    "\t}\n"
+    "}\n"
+    "return total > limit ? -1 : total;\n" },
+  { "repeats",
+    "llllllllllllllllllllllllllllllllllllllllllllllllll"
+    "aaaaaaaaaaaaaaaaaaaaaaaaa   bookkeeper  committee  "
+    "1111111111222222222233333333334444444444\n" },
+  { "shifted",
+    "!@#$%^&*()_+{}|:\"<>?~ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "!@#$%^&*()_+{}|:\"<>?~ABCDEFGHIJKLMNOPQRSTUVWXYZ\n" },
+};
+
+// --- US ASCII MAP -----------------------------------------------------------
+
+static bool lookupKey(char c, uint8_t *key, uint8_t *modifiers) {
+  uint8_t code = (uint8_t)c < 128 ? pgm_read_byte(&asciiToKeyMap[(uint8_t)c]) : 0;
+
+  *key = code & ~ASCII_SHIFT;
+  *modifiers = (code & ASCII_SHIFT) ? MOD_SHIFT_LEFT : 0;
+  return code != 0;
+}
+
+// --- SEND STRATEGIES --------------------------------------------------------
+
+// A strategy queues text starting at 'text' and returns how many characters
+// it consumed, or 0 if the device queue is full.
+struct Strategy {
+  const char *name;
+  uint16_t  (*send)(const char *text, uint16_t len);
+};
+
+static uint16_t sendKeyStrokes(const char *text, uint16_t) {
+  uint8_t key, modifiers;
+
+  lookupKey(text[0], &key, &modifiers);
+  return UsbKeyboard.sendKeyStroke(key, modifiers);
+}
+
+static uint16_t sendPackedText(const char *text, uint16_t len) {
+  return UsbKeyboard.sendText(text, len);
+}
+
+// Holds the modifiers a character needs until one needs others, so shifted
+// runs cost no modifier reports.
+static uint16_t sendHeldKeys(const char *text, uint16_t len) {
+  uint8_t key, modifiers;
+
+  if (UsbKeyboard.queueSpace() < 4 * KEYBOARD_REPORTS) {
+    return 0;
+  }
+  lookupKey(text[0], &key, &modifiers);
+  UsbKeyboard.setModifiers(modifiers);
+  UsbKeyboard.press(key);
+  UsbKeyboard.release(key);
+  if (len == 1) {
+    UsbKeyboard.releaseAll();
+  }
+  return 1;
+}
+
+static const Strategy strategies[] = {
+  { "keystroke", sendKeyStrokes },
+  { "packed", sendPackedText },
+  { "held", sendHeldKeys },
+};
+
+// --- SIMULATED HOST ---------------------------------------------------------
+
+static char           received[MAX_TEXT];
+static uint16_t       receivedCount;
+static unsigned long  receivedAt[MAX_TEXT];
+static unsigned long  enqueuedAt[MAX_TEXT];
+
+static void keyEvent(uint8_t key, bool down, uint8_t modifiers) {
+  if (down && key < HOST_FIRST_MODIFIER && receivedCount < MAX_TEXT) {
+    receivedAt[receivedCount] = usbSimTime();
+    received[receivedCount++] = hostUsChar(key, modifiers);
+  }
+}
+
+static int compareLatency(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a;
+  unsigned long y = *(const unsigned long *)b;
+  return x < y ? -1 : x > y;
+}
+
+// --- BENCHMARK --------------------------------------------------------------
+
+// Returns false if the host did not receive exactly the corpus text.
+static bool run(const Strategy *strategy, const Corpus *corpus,
+                uint8_t interval) {
+  uint16_t      len = strlen(corpus->text);
+  uint16_t      sent = 0;
+  unsigned long latency[MAX_TEXT];
+  unsigned long start, end, reports, hits, misses;
+  unsigned long deadline = usbSimFrame + 100000;
+
+  usbSimPollInterval = interval;
+  hostReset();
+  receivedCount = 0;
+  reports = usbSimStats.intrPackets;
+  hits = UsbKeyboard.crcCacheHits();
+  misses = UsbKeyboard.crcCacheMisses();
+  start = usbSimTime();
+
+  while (receivedCount < len && usbSimFrame < deadline) {
+    uint16_t n = sent < len ? strategy->send(corpus->text + sent, len - sent) : 0;
+
+    while (n--) {
+      enqueuedAt[sent++] = usbSimTime();
+    }
+    usbSimStep();
+  }
+  end = usbSimTime();
+
+  // Let the final release report go out, and the device loop see it gone,
+  // before the next run.
+  while (!UsbKeyboard.queueEmpty() || !usbInterruptIsReady()) {
+    usbSimStep();
+  }
+  usbSimStep();
+  reports = usbSimStats.intrPackets - reports;
+  hits = UsbKeyboard.crcCacheHits() - hits;
+  misses = UsbKeyboard.crcCacheMisses() - misses;
+
+  bool ok = receivedCount == len && memcmp(received, corpus->text, len) == 0;
+  for (uint16_t i = 0; i < receivedCount; i++) {
+    latency[i] = receivedAt[i] - enqueuedAt[i];
+  }
+  qsort(latency, receivedCount, sizeof(latency[0]), compareLatency);
+
+  unsigned histogram[HISTOGRAM_BUCKETS] = { 0 };
+  for (uint16_t i = 0; i < receivedCount; i++) {
+    size_t b = 0;
+
+    while (b < HISTOGRAM_BUCKETS - 1 && latency[i] >= histogramBounds[b] * 1000UL) {
+      b++;
+    }
+    histogram[b]++;
+  }
+
+  char buckets[HISTOGRAM_BUCKETS * 8] = "";
+  for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    sprintf(buckets + strlen(buckets), "%s%u", b ? "," : "", histogram[b]);
+  }
+
+  double seconds = (end - start) / 1e6;
+  printf("{\"strategy\":\"%s\",\"corpus\":\"%s\",\"poll_interval_ms\":%u,"
+         "\"buffer_size\":%u,\"nkro\":%s,\"sof_aligned\":%s,"
+         "\"chars\":%u,\"reports\":%lu,"
+         "\"chars_per_second\":%.1f,\"reports_per_char\":%.3f,"
+         "\"latency_p50_ms\":%.3f,\"latency_p99_ms\":%.3f,"
+         "\"latency_histogram\":[%s],\"crc_hits\":%lu,\"crc_misses\":%lu,\"ok\":%s}\n",
+         strategy->name, corpus->name, interval, BUFFER_SIZE,
+         KEYBOARD_NKRO ? "true" : "false",
+         KEYBOARD_SOF_ALIGNED ? "true" : "false", len, reports,
+         len / seconds, (double)reports / len,
+         receivedCount ? latency[receivedCount / 2] / 1e3 : 0.0,
+         receivedCount ? latency[receivedCount * 99 / 100] / 1e3 : 0.0,
+         buckets, hits, misses, ok ? "true" : "false");
+  return ok;
+}
+
+int main() {
+  static const uint8_t intervals[] = { 1, 2, 5, 10 };
+  int failed = 0;
+
+  if (!hostConnect(keyEvent)) {
+    fprintf(stderr, "enumeration failed\n");
+    return 1;
+  }
+  usbSimRunFrames(USB_CFG_INTR_POLL_INTERVAL * 2);
+
+  for (size_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+      for (size_t i = 0; i < sizeof(intervals); i++) {
+        failed |= !run(&strategies[s], &corpora[c], intervals[i]);
+      }
+    }
+  }
+  failed |= usbSimStats.crcErrors != 0;
+  return failed;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Builds the typing benchmark (bench.cpp) against the host simulation for
+# every BUFFER_SIZE from 2 to 7, with and without KEYBOARD_NKRO, and with
+# KEYBOARD_SOF_ALIGNED, and runs it. Output is one JSON object per
+# line on stdout, suitable for diffing between releases:
+#
+#   extras/hostsim/bench.sh > bench.jsonl
+#
+# Set CC/CXX to use other compilers. Objects go to $TMPDIR.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+LIB=$HERE/../..
+OUT=${TMPDIR:-/tmp}/usbkeyboard-bench
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+FLAGS="-O2 -DUSB_HOST_SIM=1 -I$LIB"
+
+mkdir -p "$OUT"
+
+# nkro, sof_aligned
+for mode in "0 0" "1 0" "0 1"; do
+    set -- $mode
+    MODE="-DKEYBOARD_NKRO=$1 -DKEYBOARD_SOF_ALIGNED=$2 -DUSB_COUNT_SOF=$2"
+    # usbdrv.c takes the report descriptor length from usbconfig.h.
+    $CC $FLAGS $MODE -c "$LIB/usbdrv.c" -o "$OUT/usbdrv$1$2.o"
+    $CC $FLAGS $MODE -c "$LIB/usbhostsim.c" -o "$OUT/usbhostsim$1$2.o"
+    for size in 2 3 4 5 6 7; do
+        $CXX $FLAGS $MODE -DBUFFER_SIZE=$size \
+            -o "$OUT/bench$1$2-$size" "$HERE/bench.cpp" \
+            "$OUT/usbdrv$1$2.o" "$OUT/usbhostsim$1$2.o"
+        "$OUT/bench$1$2-$size"
+    done
+done
@@ -0,0 +1,143 @@
+//*****************************************************************************
+//*     Packet Trace Capture                                                  *
+//*****************************************************************************
+//
+//      Records sessions of the keyboard on the simulated bus (see
+//      usbhostsim.h) as packet traces (see packettrace.h) for replay.cpp.
+//      Each session enumerates the device and types a random amount of
+//      random text in bursts, for one of a set of host profiles that differ
+//      in the interrupt poll interval the host picks and in how often the
+//      device loop runs per frame. Sessions without text only enumerate.
+//
+//      Traces are written to DIR as session-NNNNN.trc. The sessions are
+//      seeded by their number, so a capture is reproducible. One JSON
+//      object is printed with the sessions and packets captured.
+//
+//      Build and run from this directory:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o capture
+//            capture.cpp usbdrv.o usbhostsim.o
+//        mkdir -p traces && ./capture traces 2000
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "UsbKeyboard.h"
+#include "packettrace.h"
+
+#define MAX_TEXT  200
+
+// A host overrides the endpoint's bInterval with pollInterval unless it is
+// 0; framePolls is usbSimPollsPerFrame, the device loop rate.
+struct Host {
+  uint8_t pollInterval;
+  uint8_t framePolls;
+};
+
+static const Host hosts[] = {
+  { 0, 4 },   // honours bInterval
+  { 1, 4 },   // polls every frame
+  { 8, 4 },   // polls every 8th frame
+  { 0, 2 },   // slow device loop
+  { 2, 8 },   // fast device loop
+};
+
+static TraceWriter    writer;
+static unsigned long  packets;
+
+static void deviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+static void capturePacket(const usbSimPacket_t *packet) {
+  writer.packet(packet);
+  packets++;
+}
+
+static unsigned long currentStep(void) {
+  return usbSimFrame * usbSimPollsPerFrame + usbSimSlot;
+}
+
+// Deterministic per session, unlike rand().
+static unsigned long seed;
+
+static unsigned nextRandom(unsigned n) {
+  seed = seed * 1103515245UL + 12345;
+  return (seed >> 16) % n;
+}
+
+static bool capture(const char *dir, unsigned session) {
+  const Host *host = &hosts[session % (sizeof(hosts) / sizeof(hosts[0]))];
+  char path[512], text[MAX_TEXT];
+  uint16_t len, sent = 0;
+
+  seed = session;
+  len = nextRandom(4) == 0 ? 0 : nextRandom(MAX_TEXT);
+  for (uint16_t i = 0; i < len; i++) {
+    text[i] = nextRandom(8) == 0 ? '\n' : ' ' + nextRandom(95);
+  }
+
+  snprintf(path, sizeof(path), "%s/session-%05u.trc", dir, session);
+  UsbKeyboard.end();
+  usbSimInit(deviceLoop);
+  usbSimPollsPerFrame = host->framePolls;
+  usbSimPollInterval = host->pollInterval;
+  if (!writer.open(path)) {
+    perror(path);
+    return false;
+  }
+  usbSimSetPacketHandler(capturePacket);
+  UsbKeyboard.begin();
+  if (usbSimEnumerate() < 0) {
+    fprintf(stderr, "session %u: enumeration failed\n", session);
+    return false;
+  }
+
+  // Bursts of up to 16 characters with pauses of up to 50 ms.
+  while (sent < len) {
+    uint16_t burst = 1 + nextRandom(16);
+
+    burst = burst < len - sent ? burst : len - sent;
+    while (burst) {
+      uint16_t n = UsbKeyboard.sendText(text + sent, burst);
+
+      if (n) {
+        writer.text(currentStep(), text + sent, n);
+      }
+      sent += n;
+      burst -= n;
+      usbSimStep();
+    }
+    usbSimRunFrames(nextRandom(50));
+  }
+  while (!UsbKeyboard.queueEmpty() || !usbInterruptIsReady()) {
+    usbSimStep();
+  }
+  usbSimRunFrames(20);
+  usbSimSetPacketHandler(NULL);
+  if (!writer.close(currentStep())) {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s DIR [SESSIONS]\n", argv[0]);
+    return 2;
+  }
+
+  unsigned sessions = argc > 2 ? atoi(argv[2]) : 100;
+  for (unsigned i = 0; i < sessions; i++) {
+    if (!capture(argv[1], i)) {
+      return 1;
+    }
+  }
+  printf("{\"sessions\":%u,\"packets\":%lu}\n", sessions, packets);
+  return 0;
+}
@@ -0,0 +1,119 @@
+//*****************************************************************************
+//*     Enumeration Benchmark                                                 *
+//*****************************************************************************
+//
+//      Enumerates the keyboard on the simulated bus (see usbhostsim.h) over
+//      and over and measures the device side of it: the frames from pull-up
+//      to SET_CONFIGURATION, the control packets the device sent and, on
+//      x86, the time stamp counter cycles of the usbPoll() calls that built
+//      a descriptor chunk with usbBuildTxBlock(). One JSON object is printed
+//      with the averages.
+//
+//      A second JSON object gives the milliseconds from pull-up to the host
+//      receiving a keystroke UsbKeyboard queued before it was connected,
+//      the time until the keyboard is ready to type.
+//
+//      The frame count is fixed by the host's timing; the cycles show the
+//      cost of the driver's control transfer path. Host numbers only show
+//      the relative cost, build the same file against an older usbdrv.c
+//      to compare.
+//
+//      Build and run from this directory:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o enumerate
+//            enumerate.cpp usbdrv.o usbhostsim.o
+//        ./enumerate
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES()  __rdtsc()
+#else
+#define CYCLES()  0ULL
+#endif
+
+#include "UsbKeyboard.h"
+
+#define ENUMERATIONS  10000UL
+
+extern "C" volatile uchar usbTxLen;  // control IN buffer state, usbdrv.c
+
+static unsigned long long chunkCycles;
+static unsigned long chunks;
+
+// Times the usbPoll() calls that built a control IN chunk, i.e. found the
+// transmit buffer free and left data in it.
+static void deviceLoop(void) {
+  uchar wasFree = usbTxLen & 0x10;
+  unsigned long long start = CYCLES();
+
+  usbPoll();
+
+  unsigned long long cycles = CYCLES() - start;
+  if (wasFree && !(usbTxLen & 0x10)) {
+    chunkCycles += cycles;
+    chunks++;
+  }
+}
+
+static unsigned long readyFrame;
+
+static void keyboardLoop(void) {
+  UsbKeyboard.update();
+}
+
+static void keyboardReport(uchar ep, const uchar *data, uchar len) {
+  if (readyFrame == 0 && ep == 1 && data[0] == 1 && memcmp(data + 1,
+      "\0\0\0\0\0\0\0", len - 1) != 0) {
+    readyFrame = usbSimFrame;
+  }
+}
+
+int main() {
+  unsigned long frames = 0, packets = 0;
+
+  // One round to warm up the caches, then the measured rounds.
+  for (unsigned long i = 0; i <= ENUMERATIONS; i++) {
+    usbSimInit(deviceLoop);
+    UsbKeyboard.begin(0);   // attach at once, the loop only runs usbPoll()
+    if (i == 1) {
+      chunkCycles = chunks = frames = packets = 0;
+    }
+
+    long n = usbSimEnumerate();
+    if (n < 0) {
+      fprintf(stderr, "enumeration %lu failed\n", i);
+      return 1;
+    }
+    frames += n;
+    packets += usbSimStats.ep0Packets;
+  }
+
+  printf("{\"enumerations\":%lu,\"frames\":%.1f,\"ep0_packets\":%.1f,"
+         "\"chunks\":%.1f,\"cycles_per_chunk\":%.1f}\n",
+         ENUMERATIONS, (double)frames / ENUMERATIONS,
+         (double)packets / ENUMERATIONS, (double)chunks / ENUMERATIONS,
+         (double)chunkCycles / chunks);
+
+  // usbSimEnumerate() counts from the end of the disconnect interval.
+  UsbKeyboard.end();
+  usbSimInit(keyboardLoop);
+  usbSimSetReportHandler(keyboardReport);
+  UsbKeyboard.begin();
+  UsbKeyboard.sendKeyStroke(KEY_A);
+
+  long configured = usbSimEnumerate();
+  while (readyFrame == 0 && usbSimFrame < 1000) {
+    usbSimStep();
+  }
+  printf("{\"poll_interval_ms\":%u,\"disconnect_ms\":%u,"
+         "\"ms_to_configured\":%ld,\"ms_to_ready\":%lu,"
+         "\"toggle_errors\":%lu}\n",
+         usbSimPollInterval, DISCONNECT_INTERVAL, configured,
+         readyFrame - DISCONNECT_INTERVAL, usbSimStats.toggleErrors);
+  return readyFrame == 0;
+}
@@ -0,0 +1,73 @@
+//*****************************************************************************
+//*     UsbKeyboard Host Simulation Demo                                      *
+//*****************************************************************************
+//
+//      Runs UsbKeyboardDevice unchanged on a Linux host against the
+//      simulated bus in usbhostsim.c: the simulated host enumerates the
+//      device, the demo types "HELLO WORLD", turns the volume up halfway
+//      through and every interrupt report the host receives is printed
+//      together with its frame number.
+//
+//      Build and run from this directory:
+//
+//        gcc -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -DUSB_HOST_SIM=1 -I../.. -o hostdemo hostdemo.cpp
+//            usbdrv.o usbhostsim.o
+//        ./hostdemo
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+
+#include "UsbKeyboard.h"
+
+static void deviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+static void printReport(uchar ep, const uchar *data, uchar len) {
+  printf("%6lu ms  EP%u:", usbSimFrame, ep);
+  for (uchar i = 0; i < len; i++) {
+    printf(" %02x", data[i]);
+  }
+  printf("\n");
+}
+
+int main() {
+  static const uint8_t text[] = {
+    KEY_H, KEY_E, KEY_L, KEY_L, KEY_O, KEY_SPACE,
+    KEY_W, KEY_O, KEY_R, KEY_L, KEY_D, KEY_ENTER
+  };
+
+  usbSimInit(deviceLoop);
+  usbSimSetReportHandler(printReport);
+  UsbKeyboard.begin();
+
+  long frames = usbSimEnumerate();
+  if (frames < 0) {
+    printf("enumeration failed at frame %lu\n", usbSimFrame);
+    return 1;
+  }
+  printf("enumerated in %ld ms, poll interval %u ms\n",
+         frames, usbSimPollInterval);
+
+  for (uint8_t i = 0; i < sizeof(text); i++) {
+    while (!UsbKeyboard.sendKeyStroke(text[i])) {
+      usbSimStep();
+    }
+    if (text[i] == KEY_SPACE) {
+      UsbKeyboard.sendConsumerKeyStroke(CONSUMER_VOLUME_UP);
+    }
+  }
+  while (!UsbKeyboard.queueEmpty() || !usbInterruptIsReady()) {
+    usbSimStep();
+  }
+
+  printf("setups %lu, interrupt polls %lu, NAKs %lu, reports %lu, "
+         "toggle errors %lu, CRC errors %lu\n",
+         usbSimStats.setups, usbSimStats.intrPolls, usbSimStats.intrNaks,
+         usbSimStats.intrPackets, usbSimStats.toggleErrors,
+         usbSimStats.crcErrors);
+  return 0;
+}
@@ -0,0 +1,158 @@
+//*****************************************************************************
+//*     Simulated Host Keyboard                                               *
+//*****************************************************************************
+//
+//      The host side of the checks that type through UsbKeyboard on the
+//      simulated bus (see usbhostsim.h). hostConnect() starts the device on
+//      a fresh bus with UsbKeyboard.update() as the device loop and
+//      hostReport() as the host's report handler. hostReport() decodes the
+//      keyboard reports into keys going down and up, like a host's HID
+//      driver, and hands each to the check's handler:
+//
+//        modifiers  the bits of the modifier byte, as the usages 0xE0 to
+//                   0xE7
+//        array      a key in a slot it was not in before goes down, in
+//                   slot order; a key no longer in any slot goes up
+//        bitmap     (KEYBOARD_NKRO) a bit that was clear goes down and a
+//                   bit that was set goes up, in usage order
+//
+//      Consumer reports are ignored. hostUsChar() turns a key into the
+//      character a host set to the US layout reads.
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#ifndef __hostkeyboard_h_included__
+#define __hostkeyboard_h_included__
+
+#include <string.h>
+
+#include "UsbKeyboard.h"
+
+#define HOST_FIRST_MODIFIER 0xe0
+
+// Called for every key going down or up, 'modifiers' is the modifier byte
+// the host holds at that point.
+typedef void (*hostKeyHandler_t)(uint8_t key, bool down, uint8_t modifiers);
+
+static hostKeyHandler_t hostKeyHandler;
+static unsigned long    hostReports;          // keyboard reports decoded
+#if KEYBOARD_NKRO
+static uint8_t          hostBits[NKRO_STATE_SIZE];
+#else
+static uint8_t          hostLastReport[REPORT_LENGTH];
+#endif
+
+static inline void hostKey(uint8_t key, bool down, uint8_t modifiers) {
+  if (hostKeyHandler != NULL) {
+    hostKeyHandler(key, down, modifiers);
+  }
+}
+
+static inline void hostModifiers(uint8_t last, uint8_t now) {
+  for (uint8_t b = 0; b < 8; b++) {
+    if ((last ^ now) & (1 << b)) {
+      hostKey(HOST_FIRST_MODIFIER + b, (now & (1 << b)) != 0, now);
+    }
+  }
+}
+
+#if KEYBOARD_NKRO
+static inline void hostReport(uchar, const uchar *data, uchar len) {
+  if (data[0] > KEYBOARD_REPORTS) {
+    return; // consumer report
+  }
+  hostReports++;
+
+  uint8_t first = (data[0] - 1) * (REPORT_LENGTH - 1); // state byte of data[1]
+
+  for (uchar i = 1; i < len; i++) {
+    uint8_t index = first + i - 1;
+    uint8_t last = hostBits[index];
+
+    hostBits[index] = data[i];
+    if (index == 0) {
+      hostModifiers(last, data[i]);
+      continue;
+    }
+    for (uint8_t b = 0; b < 8; b++) {
+      if ((last ^ data[i]) & (1 << b)) {
+        hostKey(NKRO_FIRST_USAGE + (index - 1) * 8 + b, (data[i] & (1 << b)) != 0,
+                hostBits[0]);
+      }
+    }
+  }
+}
+#else
+static inline bool hostInSlots(const uchar *report, uchar len, uint8_t key) {
+  for (uchar i = 2; i < len; i++) {
+    if (report[i] == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void hostReport(uchar, const uchar *data, uchar len) {
+  if (data[0] != 1) {
+    return; // consumer report
+  }
+  hostReports++;
+
+  hostModifiers(hostLastReport[1], data[1]);
+  for (uchar i = 2; i < len; i++) {
+    if (hostLastReport[i] != 0 && !hostInSlots(data, len, hostLastReport[i])) {
+      hostKey(hostLastReport[i], false, data[1]);
+    }
+  }
+  for (uchar i = 2; i < len; i++) {
+    if (data[i] != 0 && !hostInSlots(hostLastReport, len, data[i])) {
+      hostKey(data[i], true, data[1]);
+    }
+  }
+  memcpy(hostLastReport, data, len);
+}
+#endif
+
+// Forgets every key the host holds, without handler calls.
+static inline void hostReset(void) {
+  hostReports = 0;
+#if KEYBOARD_NKRO
+  memset(hostBits, 0, sizeof(hostBits));
+#else
+  memset(hostLastReport, 0, sizeof(hostLastReport));
+#endif
+}
+
+static inline void hostDeviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+// Restarts UsbKeyboard on a fresh bus with 'handler' taking the keys.
+// Returns false if 'enumerate' is set and the host could not configure
+// the device.
+static inline bool hostConnect(hostKeyHandler_t handler, bool enumerate = true) {
+  UsbKeyboard.end();
+  usbSimInit(hostDeviceLoop);
+  usbSimSetReportHandler(hostReport);
+  hostKeyHandler = handler;
+  hostReset();
+  UsbKeyboard.begin();
+  return !enumerate || usbSimEnumerate() >= 0;
+}
+
+// The character a host set to the US layout reads for a key, '?' if none.
+static inline char hostUsChar(uint8_t key, uint8_t modifiers) {
+  bool shift = (modifiers & (MOD_SHIFT_LEFT | MOD_SHIFT_RIGHT)) != 0;
+
+  for (int c = 1; c < 128; c++) {
+    uint8_t code = pgm_read_byte(&asciiToKeyMap[c]);
+
+    if (code != 0 && (code & ~ASCII_SHIFT) == key && ((code & ASCII_SHIFT) != 0) == shift) {
+      return c;
+    }
+  }
+  return '?';
+}
+
+#endif // __hostkeyboard_h_included__
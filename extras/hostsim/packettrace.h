@@ -0,0 +1,246 @@
+//*****************************************************************************
+//*     Packet Trace Files                                                    *
+//*****************************************************************************
+//
+//      Reading and writing the packet traces of capture.cpp and replay.cpp.
+//      A trace holds every transaction on the simulated bus (see
+//      usbhostsim.h) with the device's response, the bus resets and the
+//      text the firmware queued, each stamped with the device loop
+//      iteration ('step') it happened before.
+//
+//      File layout, all numbers are bytes unless noted:
+//
+//        header    "VUSBTRC" 1, usbSimPollsPerFrame
+//        record    kind, step delta (LEB128 varint), then by kind:
+//          SETUP     addr, ep, pid, len, data, response
+//          OUT       same as SETUP
+//          IN        addr, ep, response
+//          reset     frames of SE0
+//          text      len, characters passed to UsbKeyboard.sendText()
+//          end       nothing, the last step of the session
+//
+//      The kind of a transaction is its token PID, a reset is
+//      USB_SIM_BUS_RESET. A DATA0/DATA1 response is followed by the length
+//      and the payload. Steps only grow, so a NAKed poll costs 5 bytes.
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#ifndef __packettrace_h_included__
+#define __packettrace_h_included__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UsbKeyboard.h"
+
+#define TRACE_MAGIC     "VUSBTRC\1"
+#define TRACE_TEXT      0x01
+#define TRACE_END       0xff
+
+struct TraceEvent {
+  uint8_t         kind;       // token PID, USB_SIM_BUS_RESET, TRACE_TEXT or TRACE_END
+  unsigned long   step;
+  usbSimPacket_t  packet;     // transactions and resets
+  uint8_t         textLen;
+  char            text[255];
+};
+
+static inline bool hasResponseData(uint8_t response) {
+  return response == USBPID_DATA0 || response == USBPID_DATA1;
+}
+
+// --- WRITER -----------------------------------------------------------------
+
+class TraceWriter {
+ public:
+  TraceWriter() : file(NULL), lastStep(0) {}
+
+  bool open(const char *path) {
+    file = fopen(path, "wb");
+    if (file == NULL) {
+      return false;
+    }
+    fwrite(TRACE_MAGIC, 1, 8, file);
+    fputc(usbSimPollsPerFrame, file);
+    lastStep = 0;
+    return true;
+  }
+
+  void packet(const usbSimPacket_t *p) {
+    record(p->token, p->step);
+    if (p->token == USB_SIM_BUS_RESET) {
+      fputc(p->len, file);
+      return;
+    }
+    fputc(p->addr, file);
+    fputc(p->ep, file);
+    if (p->token != USBPID_IN) {
+      fputc(p->pid, file);
+      fputc(p->len, file);
+      fwrite(p->data, 1, p->len, file);
+    }
+    fputc(p->response, file);
+    if (hasResponseData(p->response)) {
+      fputc(p->responseLen, file);
+      fwrite(p->responseData, 1, p->responseLen, file);
+    }
+  }
+
+  void text(unsigned long step, const char *text, uint8_t len) {
+    record(TRACE_TEXT, step);
+    fputc(len, file);
+    fwrite(text, 1, len, file);
+  }
+
+  // Writes the end record and closes the file. Returns false on a write
+  // error.
+  bool close(unsigned long step) {
+    record(TRACE_END, step);
+
+    bool ok = !ferror(file);
+    ok &= fclose(file) == 0;
+    file = NULL;
+    return ok;
+  }
+
+ private:
+  void record(uint8_t kind, unsigned long step) {
+    unsigned long delta = step - lastStep;
+
+    fputc(kind, file);
+    while (delta >= 0x80) {
+      fputc((delta & 0x7f) | 0x80, file);
+      delta >>= 7;
+    }
+    fputc(delta, file);
+    lastStep = step;
+  }
+
+  FILE           *file;
+  unsigned long   lastStep;
+};
+
+// --- READER -----------------------------------------------------------------
+
+// Reads the whole file at once, replaying is bound by parsing otherwise.
+class TraceReader {
+ public:
+  TraceReader()
+      : data(NULL), size(0), pos(0), step(0), pollsPerFrame(0), ended(false) {}
+  ~TraceReader() { free(data); }
+
+  bool open(const char *path) {
+    FILE *file = fopen(path, "rb");
+
+    free(data);
+    data = NULL;
+    if (file == NULL) {
+      return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = (uint8_t *)malloc(size ? size : 1);
+
+    bool ok = data != NULL && fread(data, 1, size, file) == size;
+    fclose(file);
+    if (!ok || size < 9 || memcmp(data, TRACE_MAGIC, 8) != 0) {
+      return false;
+    }
+    pollsPerFrame = data[8];
+    pos = 9;
+    step = 0;
+    ended = false;
+    return pollsPerFrame != 0;
+  }
+
+  uint8_t framePolls() const { return pollsPerFrame; }
+
+  // Returns false at the end record or if the file is truncated or
+  // corrupt; truncated() tells which.
+  bool next(TraceEvent *e) {
+    if (!byte(&e->kind) || !varint(&e->step)) {
+      return false;
+    }
+    step += e->step;
+    e->step = step;
+
+    usbSimPacket_t *p = &e->packet;
+    p->step = step;
+    p->token = e->kind;
+    switch (e->kind) {
+    case TRACE_END:
+      ended = true;
+      return false;
+    case TRACE_TEXT:
+      return byte(&e->textLen) && bytes(e->text, e->textLen);
+    case USB_SIM_BUS_RESET:
+      return byte(&p->len);
+    case USBPID_SETUP:
+    case USBPID_OUT:
+      if (!byte(&p->addr) || !byte(&p->ep) || !byte(&p->pid) ||
+          !byte(&p->len) || p->len > sizeof(p->data) ||
+          !bytes(p->data, p->len)) {
+        return false;
+      }
+      break;
+    case USBPID_IN:
+      if (!byte(&p->addr) || !byte(&p->ep)) {
+        return false;
+      }
+      p->pid = p->len = 0;
+      break;
+    default:
+      return false;
+    }
+    p->responseLen = 0;
+    if (!byte(&p->response)) {
+      return false;
+    }
+    return !hasResponseData(p->response) ||
+           (byte(&p->responseLen) && p->responseLen <= sizeof(p->responseData) &&
+            bytes(p->responseData, p->responseLen));
+  }
+
+  bool truncated() const { return !ended; }
+
+ private:
+  bool byte(uint8_t *b) {
+    return bytes(b, 1);
+  }
+
+  bool bytes(void *dst, size_t n) {
+    if (size - pos < n) {
+      return false;
+    }
+    memcpy(dst, data + pos, n);
+    pos += n;
+    return true;
+  }
+
+  bool varint(unsigned long *v) {
+    uint8_t b;
+
+    *v = 0;
+    for (unsigned shift = 0; shift < 32; shift += 7) {
+      if (!byte(&b)) {
+        return false;
+      }
+      *v |= (unsigned long)(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint8_t        *data;
+  size_t          size, pos;
+  unsigned long   step;
+  uint8_t         pollsPerFrame;
+  bool            ended;
+};
+
+#endif // __packettrace_h_included__
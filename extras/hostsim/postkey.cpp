@@ -0,0 +1,140 @@
+//*****************************************************************************
+//*     Key Event Ring Stress Check                                           *
+//*****************************************************************************
+//
+//      Checks the wait-free key event ring of UsbKeyboardDevice::postKey()
+//      on the simulated bus (see usbhostsim.h) with a real second thread
+//      in place of the interrupt that posts:
+//
+//        full      without update() the ring takes KEY_EVENT_QUEUE_SIZE
+//                  events; the next postKey() returns 0 and is not applied,
+//                  the ones before are applied in order
+//        threaded  a producer thread posts taps of changing keys as fast as
+//                  the ring takes them while the main thread runs the
+//                  device loop and the host; the host must see every tap
+//                  exactly once and in posting order
+//
+//      The ring indices use the GCC atomic builtins in the host build, so
+//      the check can also be built with -fsanitize=thread. One JSON object
+//      is printed per check. The exit status is non-zero if any fails.
+//
+//      Build and run from this directory:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -pthread -o postkey
+//            postkey.cpp usbdrv.o usbhostsim.o
+//        ./postkey
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "UsbKeyboard.h"
+#include "hostkeyboard.h"
+
+#define TAPS  20000UL
+
+// The key of tap i, never the same twice in a row.
+static uint8_t tapKey(unsigned long i) {
+  return KEY_A + i % 26;
+}
+
+// --- SIMULATED HOST ---------------------------------------------------------
+
+static unsigned long  downs;          // key-downs seen
+static unsigned long  wrong;          // key-downs out of order
+static unsigned long  firstWrong = ~0UL;
+
+static void keyEvent(uint8_t key, bool down, uint8_t) {
+  if (!down || key >= HOST_FIRST_MODIFIER) {
+    return;
+  }
+  if (key != tapKey(downs) && wrong++ == 0) {
+    firstWrong = downs;
+  }
+  downs++;
+}
+
+static void connect(void) {
+  hostConnect(keyEvent);
+  usbSimPollInterval = 1;
+  downs = wrong = 0;
+  firstWrong = ~0UL;
+}
+
+// --- CHECKS -----------------------------------------------------------------
+
+static bool checkFull(void) {
+  unsigned accepted = 0;
+
+  connect();
+  // Taps of the first keys, then a down that must not fit.
+  for (unsigned long i = 0; i < KEY_EVENT_QUEUE_SIZE / 2; i++) {
+    accepted += UsbKeyboard.postKey(tapKey(i), true);
+    accepted += UsbKeyboard.postKey(tapKey(i), false);
+  }
+  bool refused = UsbKeyboard.postKey(KEY_1, true) == 0;
+
+  usbSimRunFrames(200);
+
+  bool ok = accepted == KEY_EVENT_QUEUE_SIZE && refused &&
+            downs == KEY_EVENT_QUEUE_SIZE / 2 && wrong == 0;
+  printf("{\"check\":\"full\",\"accepted\":%u,\"refused\":%s,\"downs\":%lu,"
+         "\"ok\":%s}\n", accepted, refused ? "true" : "false", downs,
+         ok ? "true" : "false");
+  return ok;
+}
+
+static volatile bool  producerDone;
+static unsigned long  fullReturns;
+
+static void *producer(void *) {
+  for (unsigned long i = 0; i < TAPS * 2; i++) {
+    // A full ring is left alone; on a single core the device loop only
+    // gets to empty it once this thread gives up the CPU.
+    while (!UsbKeyboard.postKey(tapKey(i / 2), !(i & 1))) {
+      fullReturns++;
+      sched_yield();
+    }
+  }
+  __atomic_store_n(&producerDone, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static bool checkThreaded(void) {
+  pthread_t thread;
+
+  connect();
+  producerDone = false;
+  fullReturns = 0;
+  if (pthread_create(&thread, NULL, producer, NULL) != 0) {
+    perror("pthread_create");
+    return false;
+  }
+  while (!__atomic_load_n(&producerDone, __ATOMIC_ACQUIRE)) {
+    usbSimStep();
+    if (usbSimSlot == 0) {
+      sched_yield();    // one frame done, let the producer in
+    }
+  }
+  pthread_join(thread, NULL);
+  usbSimRunFrames(200);
+
+  bool ok = downs == TAPS && wrong == 0 && fullReturns != 0;
+  printf("{\"check\":\"threaded\",\"taps\":%lu,\"downs\":%lu,\"out_of_order\":%lu,"
+         "\"first_out_of_order\":%ld,\"full_returns\":%lu,\"frames\":%lu,\"ok\":%s}\n",
+         TAPS, downs, wrong, wrong ? (long)firstWrong : -1L, fullReturns,
+         usbSimFrame, ok ? "true" : "false");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+
+  ok &= checkFull();
+  ok &= checkThreaded();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+//*****************************************************************************
+//*     Print Check                                                           *
+//*****************************************************************************
+//
+//      Types numbers and text through the Print interface of
+//      UsbKeyboardDevice on the simulated bus (see usbhostsim.h) and checks
+//      what the host reads back:
+//
+//        format    print() of integers, hex and doubles, printFixed() and
+//                  printHex() at their limits
+//        log       a data log of 100 lines of readings, typed with
+//                  printFixed(), with print(double) and character by
+//                  character with write(uint8_t); write() waits while the
+//                  queue is full, so all of it is typed
+//        timeout   write() to a host that never configures the device
+//                  gives up after the write timeout and sets the write error
+//
+//      One JSON object is printed per check, the log ones with the reports
+//      per character and characters per second. The exit status is non-zero
+//      if any check failed.
+//
+//      Build and run from this directory, with or without KEYBOARD_NKRO:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o print
+//            print.cpp usbdrv.o usbhostsim.o
+//        ./print
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+
+#include "UsbKeyboard.h"
+#include "hostkeyboard.h"
+
+#define MAX_TEXT        8192
+#define LOG_LINES       100
+
+// --- SIMULATED HOST ---------------------------------------------------------
+
+static char           received[MAX_TEXT];
+static uint16_t       receivedCount;
+
+static void keyEvent(uint8_t key, bool down, uint8_t modifiers) {
+  if (down && key < HOST_FIRST_MODIFIER && receivedCount < MAX_TEXT) {
+    received[receivedCount++] = hostUsChar(key, modifiers);
+  }
+}
+
+// --- CHECKS -----------------------------------------------------------------
+
+static bool connect(bool enumerate) {
+  hostConnect(keyEvent, false);
+  UsbKeyboard.clearWriteError();
+  UsbKeyboard.setWriteTimeout(WRITE_TIMEOUT);
+  receivedCount = 0;
+  return !enumerate || usbSimEnumerate() >= 0;
+}
+
+// Waits for the last report to reach the host.
+static void drain(void) {
+  UsbKeyboard.flush();
+  usbSimRunFrames(20);
+}
+
+static bool sameText(const char *expected) {
+  return receivedCount == strlen(expected) &&
+         memcmp(received, expected, receivedCount) == 0;
+}
+
+static bool checkFormat(void) {
+  static const char expected[] =
+      "t=-12.34 1013 0000BEEF -42 FF 3.142 0.000 0.7 -0.2147483648 "
+      "2147483647 0 FFFFFFFF 12\n";
+
+  connect(true);
+  UsbKeyboard.print("t=");
+  UsbKeyboard.printFixed(-1234, 2);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.print(1013);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printHex(0xbeef, 8);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.print(-42L);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.print(255, HEX);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.print(3.14159, 3);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printFixed(0, 3);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printFixed(7, 1);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printFixed(INT32_MIN, 10);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printFixed(INT32_MAX, 0);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printHex(0, 0);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.printHex(0xffffffffUL, 12);
+  UsbKeyboard.print(' ');
+  UsbKeyboard.write("12\xc3", 3);   // cut off character
+  bool cutOff = UsbKeyboard.getWriteError() != 0;
+  UsbKeyboard.println();
+  drain();
+
+  bool ok = sameText(expected) && cutOff;
+  printf("{\"check\":\"format\",\"chars\":%u,\"ok\":%s}\n", receivedCount,
+         ok ? "true" : "false");
+  return ok;
+}
+
+// Readings of a logger: sample number, temperature in 1/100 degrees and
+// pressure in 1/10 hPa.
+static int32_t temperature(int i) { return 2150 + (i * 37) % 400 - 200; }
+static int32_t pressure(int i) { return 10132 + (i * 11) % 50 - 25; }
+
+enum { LOG_FIXED, LOG_DOUBLE, LOG_BYTES };
+static const char *const logModes[] = { "fixed", "double", "bytes" };
+
+static void typeLine(int mode, int i) {
+  char line[40];
+
+  switch (mode) {
+  case LOG_FIXED:
+    UsbKeyboard.print(i);
+    UsbKeyboard.print(',');
+    UsbKeyboard.printFixed(temperature(i), 2);
+    UsbKeyboard.print(',');
+    UsbKeyboard.printFixed(pressure(i), 1);
+    UsbKeyboard.print('\n');
+    break;
+  case LOG_DOUBLE:
+    UsbKeyboard.print(i);
+    UsbKeyboard.print(',');
+    UsbKeyboard.print(temperature(i) / 100.0, 2);
+    UsbKeyboard.print(',');
+    UsbKeyboard.print(pressure(i) / 10.0, 1);
+    UsbKeyboard.print('\n');
+    break;
+  default:
+    snprintf(line, sizeof(line), "%d,%d.%02d,%d.%d\n", i, temperature(i) / 100,
+             temperature(i) % 100, pressure(i) / 10, pressure(i) % 10);
+    for (char *c = line; *c; c++) {
+      UsbKeyboard.write((uint8_t)*c);
+    }
+  }
+}
+
+static bool checkLog(int mode) {
+  static char   expected[MAX_TEXT];
+  uint16_t      len = 0;
+
+  for (int i = 0; i < LOG_LINES; i++) {
+    len += snprintf(expected + len, sizeof(expected) - len, "%d,%d.%02d,%d.%d\n", i,
+                    temperature(i) / 100, temperature(i) % 100, pressure(i) / 10,
+                    pressure(i) % 10);
+  }
+
+  connect(true);
+  unsigned long start = usbSimTime();
+  for (int i = 0; i < LOG_LINES; i++) {
+    typeLine(mode, i);
+  }
+  drain();
+
+  double seconds = (usbSimTime() - start) / 1e6 - 0.02;   // without drain()'s frames
+  bool ok = sameText(expected) && UsbKeyboard.getWriteError() == 0;
+  printf("{\"check\":\"log\",\"mode\":\"%s\",\"nkro\":%s,\"chars\":%u,"
+         "\"reports\":%lu,\"reports_per_char\":%.3f,\"chars_per_second\":%.1f,"
+         "\"ok\":%s}\n", logModes[mode], KEYBOARD_NKRO ? "true" : "false", len,
+         hostReports, (double)hostReports / len, len / seconds, ok ? "true" : "false");
+  return ok;
+}
+
+static bool checkTimeout(void) {
+  static const char text[] =
+      "The host never polls, so the queue fills and stays full until the "
+      "write timeout has passed.";
+
+  connect(false);
+  UsbKeyboard.setWriteTimeout(100);
+
+  unsigned long start = millis();
+  size_t written = UsbKeyboard.write(text);
+  unsigned long waited = millis() - start;
+
+  bool ok = written < strlen(text) && UsbKeyboard.getWriteError() != 0 &&
+            waited >= 100 && waited <= 101;
+  printf("{\"check\":\"timeout\",\"written\":%u,\"waited_ms\":%lu,\"ok\":%s}\n",
+         (unsigned)written, waited, ok ? "true" : "false");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+
+  ok &= checkFormat();
+  for (int mode = LOG_FIXED; mode <= LOG_BYTES; mode++) {
+    ok &= checkLog(mode);
+  }
+  ok &= checkTimeout();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+//*****************************************************************************
+//*     Interrupt Report Publishing Benchmark                                 *
+//*****************************************************************************
+//
+//      Compares the two ways of handing a keyboard report to the driver:
+//
+//        staged    the report is copied from the queue into a staging
+//                  buffer and usbSetInterrupt() copies it again into the
+//                  transmit buffer (the path used up to now)
+//        inplace   the report is copied from the queue straight into
+//                  usbInterruptBuffer() and usbCommitInterrupt() finishes
+//                  it (the path UsbKeyboardDevice::update() uses)
+//
+//      Both include the CRC. Before every report the endpoint is marked
+//      empty as if the host had collected the previous one. One JSON object
+//      is printed per path with the host time and, on x86, the time stamp
+//      counter cycles per report. Host numbers only show the relative cost;
+//      on the AVR each byte copy loop (ld, st, subi, brne) costs 7 cycles
+//      per byte.
+//
+//      Build and run from this directory:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o publish
+//            publish.cpp usbdrv.o usbhostsim.o
+//        ./publish
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES()  __rdtsc()
+#else
+#define CYCLES()  0ULL
+#endif
+
+#include "UsbKeyboard.h"
+
+#define REPORTS       1000000UL
+#define REPORT_BYTES  8
+
+static uchar queue[16][REPORT_BYTES];
+static uchar staging[REPORT_BYTES];
+
+static void publishStaged(const uchar *report, uchar len) {
+  memcpy(staging, report, len);
+  usbSetInterrupt(staging, len);
+}
+
+static void publishInPlace(const uchar *report, uchar len) {
+  memcpy(usbInterruptBuffer(), report, len);
+  usbCommitInterrupt(len);
+}
+
+static void run(const char *name, void (*publish)(const uchar *, uchar),
+                uchar len) {
+  struct timespec start, end;
+  unsigned long long cycles;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  cycles = CYCLES();
+  for (unsigned long i = 0; i < REPORTS; i++) {
+    usbTxLen1 = USBPID_NAK;     // host collected the previous report
+    publish(queue[i & 15], len);
+  }
+  cycles = CYCLES() - cycles;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("{\"path\":\"%s\",\"report_bytes\":%u,\"reports\":%lu,"
+         "\"ns_per_report\":%.2f,\"cycles_per_report\":%.1f}\n",
+         name, len, REPORTS, ns / REPORTS, (double)cycles / REPORTS);
+}
+
+int main() {
+  for (int i = 0; i < 16; i++) {
+    for (int j = 0; j < REPORT_BYTES; j++) {
+      queue[i][j] = i * 7 + j;
+    }
+  }
+
+  // Warm up, then measure the array report (BUFFER_SIZE 4 plus report ID)
+  // and the full 8 byte NKRO report.
+  run("staged", publishStaged, 5);
+  for (uchar len = 5; len <= 8; len += 3) {
+    run("staged", publishStaged, len);
+    run("inplace", publishInPlace, len);
+  }
+  return 0;
+}
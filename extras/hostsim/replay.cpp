@@ -0,0 +1,348 @@
+//*****************************************************************************
+//*     Packet Trace Replay                                                   *
+//*****************************************************************************
+//
+//      Replays packet traces (see packettrace.h, recorded by capture.cpp)
+//      into the driver and compares the device's responses with the
+//      recorded ones byte for byte. The device loop runs
+//      UsbKeyboard.update(), and with it usbPoll() and usbProcessRx(),
+//      exactly as often between two packets as during the capture, and the
+//      text the firmware queued is queued again at the same loop iteration,
+//      or, if the device takes less of it, in the following ones.
+//
+//      On the control endpoint the host follows the trace packet by packet,
+//      but like a real host it waits for answers (ACK, STALL, data): if the
+//      device NAKs a token the recorded device answered, the token is sent
+//      again before every loop iteration and the rest of the trace moves
+//      back accordingly; if the device answers a token it NAKed in the
+//      recording, the host's retries of it up to the recorded answer are
+//      skipped. Interrupt endpoints are polled as recorded, and the n-th
+//      report is compared with the n-th recorded one. A token counts as a
+//      poll:
+//
+//        identical every packet was answered as recorded
+//        timing    the same answers, but n polls earlier or later
+//        content   an answer differs, is missing or never came (after 50
+//                  frames of retries), or text is left untyped at the end
+//
+//      One JSON object is printed for every trace that is not identical,
+//      with the first differing packet, and one at the end with the totals
+//      and how much faster than real time the traces were replayed. The
+//      exit status is non-zero if any trace is not identical.
+//
+//      Build and run from this directory, with the same flags as capture:
+//
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o replay
+//            replay.cpp usbdrv.o usbhostsim.o
+//        ./replay traces/*.trc
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "UsbKeyboard.h"
+#include "packettrace.h"
+
+#define RETRY_FRAMES  50      // like the stage timeout of usbSimControl()
+#define MAX_REPORTS   2048
+#define STREAMS       17      // IN on endpoints 0 to 15, SETUP and OUT
+
+struct Report {
+  unsigned long   poll;       // index of the IN token on its endpoint
+  usbSimPacket_t  packet;
+};
+
+struct Stream {
+  // Control: answer the device gave ahead of the recording, until the
+  // recorded one.
+  bool            ahead;
+  unsigned        skipped;    // recorded polls skipped meanwhile
+  usbSimPacket_t  early;
+  // Interrupt: reports recorded and replayed.
+  unsigned long   polls;
+  unsigned        reports[2];
+  Report          report[2][MAX_REPORTS];
+};
+
+struct Result {
+  bool          corrupt;
+  bool          content;
+  unsigned      maxShift;     // polls
+  char          firstDiff[200];
+  unsigned long packets;
+  unsigned long frames;
+};
+
+static Stream         streams[STREAMS];
+static unsigned long  delay;  // steps the device is behind the recording
+
+static void deviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+static unsigned long currentStep(void) {
+  return usbSimFrame * usbSimPollsPerFrame + usbSimSlot;
+}
+
+static bool isAnswer(uint8_t response) {
+  return response != USBPID_NAK && response != 0;
+}
+
+static bool sameResponse(const usbSimPacket_t *a, const usbSimPacket_t *b) {
+  return a->response == b->response && a->responseLen == b->responseLen &&
+         memcmp(a->responseData, b->responseData, a->responseLen) == 0;
+}
+
+static void describe(char *buf, const usbSimPacket_t *p) {
+  switch (p->response) {
+  case USBPID_ACK: strcpy(buf, "ACK"); return;
+  case USBPID_NAK: strcpy(buf, "NAK"); return;
+  case USBPID_STALL: strcpy(buf, "STALL"); return;
+  case 0: strcpy(buf, "none"); return;
+  }
+  buf += sprintf(buf, p->response == USBPID_DATA0 ? "DATA0" : "DATA1");
+  for (uint8_t i = 0; i < p->responseLen; i++) {
+    buf += sprintf(buf, " %02x", p->responseData[i]);
+  }
+}
+
+static void noteDiff(Result *r, const usbSimPacket_t *expected,
+                     const usbSimPacket_t *got) {
+  char e[40], g[40];
+
+  if (r->firstDiff[0] != 0) {
+    return;
+  }
+  describe(e, expected);
+  describe(g, got);
+  snprintf(r->firstDiff, sizeof(r->firstDiff),
+           "\"frame\":%lu,\"slot\":%u,\"packet\":\"%s ep%u\","
+           "\"expected\":\"%s\",\"got\":\"%s\"", usbSimFrame, usbSimSlot,
+           got->token == USBPID_SETUP ? "SETUP" : got->token == USBPID_OUT ? "OUT" : "IN",
+           got->ep, e, g);
+}
+
+// --- REPLAY -----------------------------------------------------------------
+
+// Text the device did not take yet. Like a firmware loop that retries
+// sendText() until all is queued, the replay offers it again before every
+// iteration of the device loop.
+static char     pending[1024];
+static uint16_t pendingLen;
+
+static void offerPending(void) {
+  if (pendingLen != 0) {
+    uint16_t n = UsbKeyboard.sendText(pending, pendingLen);
+
+    pendingLen -= n;
+    memmove(pending, pending + n, pendingLen);
+  }
+}
+
+static void step(void) {
+  offerPending();
+  usbSimStep();
+}
+
+static void stepTo(unsigned long recordedStep) {
+  while (currentStep() < recordedStep + delay) {
+    step();
+  }
+}
+
+static void addReport(Stream *s, int which, const usbSimPacket_t *packet) {
+  if (isAnswer(packet->response) && s->reports[which] < MAX_REPORTS) {
+    Report *report = &s->report[which][s->reports[which]++];
+
+    report->poll = s->polls;
+    report->packet = *packet;
+  }
+}
+
+static void replayInterrupt(Stream *s, const usbSimPacket_t *recorded, Result *r) {
+  usbSimPacket_t packet = *recorded;
+
+  usbSimTransaction(&packet);
+  r->packets++;
+  if (!sameResponse(&packet, recorded)) {
+    noteDiff(r, recorded, &packet);
+  }
+  addReport(s, 0, recorded);
+  addReport(s, 1, &packet);
+  s->polls++;
+}
+
+// Pairs the reports of an interrupt endpoint in order.
+static void compareReports(Stream *s, Result *r) {
+  if (s->reports[0] != s->reports[1]) {
+    r->content = true;
+  }
+  for (unsigned i = 0; i < s->reports[0] && i < s->reports[1]; i++) {
+    Report *recorded = &s->report[0][i], *replayed = &s->report[1][i];
+    unsigned shift = labs((long)(replayed->poll - recorded->poll));
+
+    if (!sameResponse(&recorded->packet, &replayed->packet)) {
+      r->content = true;
+    }
+    r->maxShift = shift > r->maxShift ? shift : r->maxShift;
+  }
+}
+
+static void replayPacket(const usbSimPacket_t *recorded, Result *r) {
+  Stream *s = &streams[recorded->token == USBPID_IN ? recorded->ep & 15 : 16];
+  usbSimPacket_t packet = *recorded;
+
+  if (recorded->token == USBPID_IN && recorded->ep != 0) {
+    replayInterrupt(s, recorded, r);
+    return;
+  }
+
+  if (s->ahead) {
+    // The device answered this stream early; drop the host's retries up to
+    // the recorded answer and compare that with the early one.
+    s->skipped++;
+    if (!isAnswer(recorded->response)) {
+      return;
+    }
+    s->ahead = false;
+    if (!sameResponse(&s->early, recorded)) {
+      noteDiff(r, recorded, &s->early);
+      r->content = true;
+    }
+    r->maxShift = s->skipped > r->maxShift ? s->skipped : r->maxShift;
+    return;
+  }
+
+  usbSimTransaction(&packet);
+  r->packets++;
+  if (sameResponse(&packet, recorded)) {
+    return;
+  }
+  noteDiff(r, recorded, &packet);
+  if (!isAnswer(recorded->response) && isAnswer(packet.response)) {
+    s->ahead = true;
+    s->skipped = 0;
+    s->early = packet;
+    return;
+  }
+  if (isAnswer(recorded->response) && !isAnswer(packet.response)) {
+    unsigned retries = 0;
+
+    while (!isAnswer(packet.response) && retries < RETRY_FRAMES * usbSimPollsPerFrame) {
+      step();
+      delay++;
+      retries++;
+      packet = *recorded;
+      usbSimTransaction(&packet);
+      r->packets++;
+    }
+    r->maxShift = retries > r->maxShift ? retries : r->maxShift;
+  }
+  if (!sameResponse(&packet, recorded)) {
+    r->content = true;
+  }
+}
+
+static void replay(const char *path, Result *r) {
+  TraceReader reader;
+  TraceEvent  e;
+
+  memset(r, 0, sizeof(*r));
+  for (int i = 0; i < STREAMS; i++) {
+    streams[i].ahead = false;
+    streams[i].polls = 0;
+    streams[i].reports[0] = streams[i].reports[1] = 0;
+  }
+  delay = 0;
+  pendingLen = 0;
+  if (!reader.open(path)) {
+    r->corrupt = true;
+    return;
+  }
+
+  UsbKeyboard.end();
+  usbSimInit(deviceLoop);
+  usbSimPollsPerFrame = reader.framePolls();
+  UsbKeyboard.begin();
+
+  bool overflow = false;
+  while (reader.next(&e)) {
+    if (e.kind == TRACE_TEXT) {
+      // Queued by the firmware on its own time, not the host's.
+      while (currentStep() < e.step) {
+        step();
+      }
+      overflow = pendingLen + e.textLen > sizeof(pending);
+      if (overflow) {
+        break;
+      }
+      memcpy(pending + pendingLen, e.text, e.textLen);
+      pendingLen += e.textLen;
+      offerPending();
+    } else {
+      stepTo(e.step);
+      replayPacket(&e.packet, r);
+    }
+  }
+  if (!overflow) {
+    if (reader.truncated()) {
+      r->corrupt = true;
+      return;
+    }
+    stepTo(e.step);
+  }
+  r->frames = usbSimFrame;
+  for (int i = 0; i < STREAMS; i++) {
+    r->content |= streams[i].ahead;   // answered, but never in the recording
+    compareReports(&streams[i], r);
+  }
+  if (overflow || pendingLen != 0) {
+    if (r->firstDiff[0] == 0) {
+      snprintf(r->firstDiff, sizeof(r->firstDiff),
+               "\"frame\":%lu,\"slot\":%u,\"packet\":\"text\","
+               "\"expected\":\"all typed\",\"got\":\"%u characters left\"",
+               usbSimFrame, usbSimSlot, pendingLen);
+    }
+    r->content = true;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long traces = 0, identical = 0, timing = 0, content = 0, corrupt = 0;
+  unsigned long packets = 0, frames = 0;
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 1; i < argc; i++) {
+    Result r;
+
+    replay(argv[i], &r);
+    traces++;
+    packets += r.packets;
+    frames += r.frames;
+    if (r.corrupt) {
+      printf("{\"trace\":\"%s\",\"result\":\"corrupt\"}\n", argv[i]);
+      corrupt++;
+    } else if (r.content) {
+      printf("{\"trace\":\"%s\",\"result\":\"content\",%s}\n", argv[i], r.firstDiff);
+      content++;
+    } else if (r.firstDiff[0] != 0) {
+      printf("{\"trace\":\"%s\",\"result\":\"timing\",\"max_shift_polls\":%u,%s}\n",
+             argv[i], r.maxShift, r.firstDiff);
+      timing++;
+    } else {
+      identical++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("{\"traces\":%lu,\"identical\":%lu,\"timing\":%lu,\"content\":%lu,"
+         "\"corrupt\":%lu,\"packets\":%lu,\"simulated_s\":%.1f,\"wall_s\":%.3f,"
+         "\"speedup\":%.0f}\n", traces, identical, timing, content, corrupt,
+         packets, frames / 1e3, seconds, seconds > 0 ? frames / 1e3 / seconds : 0.0);
+  return identical != traces;
+}
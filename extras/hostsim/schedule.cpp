@@ -0,0 +1,192 @@
+//*****************************************************************************
+//*     Scheduler Accuracy Check                                              *
+//*****************************************************************************
+//
+//      Checks the UsbKeyboard scheduler against the frames of the simulated
+//      bus (see usbhostsim.h), with the frame clock driven by the host's
+//      start-of-frame markers:
+//
+//        callback  schedule() callbacks for delays from 0 to 1000 ms must
+//                  run in exactly the frame they are due in
+//        hold      the host must see the key release of pressKeyFor() at
+//                  its first poll after the frame the release is due in
+//        paced     the host must see each character of sendTextPaced() at
+//                  its first poll after the frame the character is due in
+//
+//      The host polls at the start of a frame, before the device has run in
+//      it, so a report due in a polled frame waits for the next poll: the
+//      host sees it 1 to poll interval ms late.
+//
+//      One JSON object is printed per check with how early (negative) and
+//      how late the host saw the events, in milliseconds. The exit status
+//      is non-zero if any check fails.
+//
+//      Build and run from this directory:
+//
+//        gcc -DUSB_HOST_SIM=1 -DUSB_COUNT_SOF=1 -I../.. -c ../../usbdrv.c
+//            ../../usbhostsim.c
+//        g++ -DUSB_HOST_SIM=1 -DUSB_COUNT_SOF=1 -I../.. -o schedule
+//            schedule.cpp usbdrv.o usbhostsim.o
+//        ./schedule
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "UsbKeyboard.h"
+
+#if !USB_COUNT_SOF
+#error "build with -DUSB_COUNT_SOF=1"
+#endif
+
+#define MAX_EVENTS  32
+
+static unsigned long  keyDownAt[MAX_EVENTS];
+static unsigned long  keyUpAt[MAX_EVENTS];
+static uint8_t        keyDowns, keyUps;
+static bool           keyIsDown;
+
+static void deviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+static void hostReport(uchar, const uchar *data, uchar) {
+  bool down = data[0] == 1 && data[2] != 0;
+
+  if (data[0] != 1 || down == keyIsDown) {
+    return;
+  }
+  keyIsDown = down;
+  if (down && keyDowns < MAX_EVENTS) {
+    keyDownAt[keyDowns++] = usbSimFrame;
+  } else if (!down && keyUps < MAX_EVENTS) {
+    keyUpAt[keyUps++] = usbSimFrame;
+  }
+}
+
+static void runUntil(bool (*done)(void), unsigned long frames) {
+  unsigned long deadline = usbSimFrame + frames;
+
+  while (!done() && usbSimFrame < deadline) {
+    usbSimStep();
+  }
+}
+
+// Errors of observed minus due frame.
+static long minError, maxError;
+
+static void resetErrors(void) {
+  minError = 0x7fffffffL;
+  maxError = -0x7fffffffL;
+}
+
+static void addError(unsigned long observed, unsigned long due) {
+  long e = (long)(observed - due);
+
+  minError = e < minError ? e : minError;
+  maxError = e > maxError ? e : maxError;
+}
+
+static bool report(const char *check, bool complete, long maxLate) {
+  bool ok = complete && minError >= 0 && maxError <= maxLate;
+
+  printf("{\"check\":\"%s\",\"poll_interval_ms\":%u,\"min_error_ms\":%ld,"
+         "\"max_error_ms\":%ld,\"ok\":%s}\n", check, usbSimPollInterval,
+         minError, maxError, ok ? "true" : "false");
+  return ok;
+}
+
+// --- CALLBACKS --------------------------------------------------------------
+
+static const uint16_t delays[] = { 0, 1, 2, 15, 16, 17, 333, 1000 };
+#define DELAYS  (sizeof(delays) / sizeof(delays[0]))
+
+static unsigned long  dueFrame[DELAYS];
+static unsigned long  ranFrame[DELAYS];
+static uint8_t        callbacksRun;
+
+static void callback(void *arg) {
+  ranFrame[(uintptr_t)arg] = usbSimFrame;
+  callbacksRun++;
+}
+
+static bool allCallbacksRun(void) {
+  return callbacksRun == DELAYS;
+}
+
+static bool checkCallbacks(void) {
+  resetErrors();
+  for (uintptr_t i = 0; i < DELAYS; i++) {
+    dueFrame[i] = usbSimFrame + (delays[i] != 0 ? delays[i] : 1);
+    UsbKeyboard.schedule(delays[i], callback, (void *)i);
+  }
+  runUntil(allCallbacksRun, 2000);
+  for (uint8_t i = 0; i < DELAYS; i++) {
+    addError(ranFrame[i], dueFrame[i]);
+  }
+  return report("callback", callbacksRun == DELAYS, 0);
+}
+
+// --- HOLD -------------------------------------------------------------------
+
+static bool keyReleased(void) {
+  return keyUps != 0;
+}
+
+static bool checkHold(uint16_t holdMs) {
+  unsigned long due = usbSimFrame + holdMs;
+
+  resetErrors();
+  keyDowns = keyUps = 0;
+  UsbKeyboard.pressKeyFor(KEY_A, 0, holdMs);
+  runUntil(keyReleased, holdMs + 100);
+  addError(keyUpAt[0], due);
+  return report("hold", keyUps != 0, usbSimPollInterval);
+}
+
+// --- PACED TEXT -------------------------------------------------------------
+
+static bool pacedDone(void) {
+  return UsbKeyboard.pacedTextLeft() == 0 && UsbKeyboard.queueEmpty() &&
+         !keyIsDown;
+}
+
+static bool checkPaced(uint16_t intervalMs) {
+  static const char text[] = "paced text";
+  unsigned long start = usbSimFrame + 1;
+
+  resetErrors();
+  keyDowns = keyUps = 0;
+  UsbKeyboard.sendTextPaced(text, sizeof(text) - 1, intervalMs);
+  runUntil(pacedDone, intervalMs * sizeof(text) + 100);
+  for (uint8_t i = 0; i < keyDowns; i++) {
+    addError(keyDownAt[i], start + i * intervalMs);
+  }
+  return report("paced", keyDowns == sizeof(text) - 1, usbSimPollInterval);
+}
+
+int main() {
+  bool ok = true;
+
+  usbSimInit(deviceLoop);
+  usbSimSetReportHandler(hostReport);
+  UsbKeyboard.begin();
+  if (usbSimEnumerate() < 0) {
+    fprintf(stderr, "enumeration failed\n");
+    return 1;
+  }
+
+  static const uint8_t intervals[] = { 1, 2, 5, 10 };
+
+  ok &= checkCallbacks();
+  for (size_t i = 0; i < sizeof(intervals); i++) {
+    usbSimPollInterval = intervals[i];
+    ok &= checkHold(300);
+    ok &= checkHold(1000);
+    ok &= checkPaced(50);
+    ok &= checkPaced(125);
+  }
+  return !ok;
+}
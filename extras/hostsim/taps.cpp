@@ -0,0 +1,110 @@
+//*****************************************************************************
+//*     Tap Merge Check                                                       *
+//*****************************************************************************
+//
+//      Checks that merging the states queued while endpoint 1 is busy (see
+//      stateRedundant() in UsbKeyboard.h) never hides a tap from the host.
+//      A key or modifier is pressed and its report loaded into the
+//      endpoint, then released, pressed again and released before the
+//      host's next poll. The host must see it go down and up twice:
+//
+//        key        press() and release() of KEY_A
+//        modifier   press() and release() of the usage 0xE0, left control
+//        setmods    setModifiers() with and without left control
+//        chord      a shift tap while KEY_A stays down
+//
+//      One JSON object is printed per case, with and without a key held
+//      from before. The exit status is non-zero if any case fails.
+//
+//      Build and run from this directory:
+//
+//        gcc -O2 -DUSB_HOST_SIM=1 -I../.. -c ../../usbdrv.c ../../usbhostsim.c
+//        g++ -O2 -DUSB_HOST_SIM=1 -I../.. -o taps
+//            taps.cpp usbdrv.o usbhostsim.o
+//        ./taps
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+
+#include "UsbKeyboard.h"
+#include "hostkeyboard.h"
+
+#if KEYBOARD_NKRO
+#error "bitmap states are never merged, build without KEYBOARD_NKRO"
+#endif
+
+struct Case {
+  const char *name;
+  uint8_t     key;        // usage the host watches, modifiers from 0xE0
+  void      (*down)(void);
+  void      (*up)(void);
+};
+
+static void keyDown(void) { UsbKeyboard.press(KEY_A); }
+static void keyUp(void) { UsbKeyboard.release(KEY_A); }
+static void ctrlDown(void) { UsbKeyboard.press(0xe0); }
+static void ctrlUp(void) { UsbKeyboard.release(0xe0); }
+static void modsDown(void) { UsbKeyboard.setModifiers(MOD_CONTROL_LEFT); }
+static void modsUp(void) { UsbKeyboard.setModifiers(0); }
+static void shiftDown(void) { UsbKeyboard.press(0xe1); }
+static void shiftUp(void) { UsbKeyboard.release(0xe1); }
+
+static const Case cases[] = {
+  { "key", KEY_A, keyDown, keyUp },
+  { "modifier", 0xe0, ctrlDown, ctrlUp },
+  { "setmods", 0xe0, modsDown, modsUp },
+  { "chord", 0xe1, shiftDown, shiftUp },
+};
+
+// --- SIMULATED HOST ---------------------------------------------------------
+
+static const Case *watched;
+static unsigned    downs, ups;
+
+static void keyEvent(uint8_t key, bool down, uint8_t) {
+  if (key == watched->key) {
+    downs += down;
+    ups += !down;
+  }
+}
+
+// --- CHECK ------------------------------------------------------------------
+
+// Returns false if the host did not see two taps.
+static bool run(const Case *c, uint8_t heldKey) {
+  watched = c;
+  hostConnect(keyEvent);
+  downs = ups = 0;
+
+  if (heldKey != 0 || c->down == shiftDown) {
+    UsbKeyboard.press(heldKey != 0 ? heldKey : KEY_A);
+  }
+  c->down();
+  // Wait until the press sits in the endpoint, the host has not polled yet.
+  while (!UsbKeyboard.queueEmpty()) {
+    usbSimStep();
+  }
+  c->up();
+  c->down();
+  c->up();
+  usbSimRunFrames(100);
+
+  bool ok = downs == 2 && ups == 2;
+  printf("{\"case\":\"%s\",\"held_key\":%u,\"downs\":%u,\"ups\":%u,\"ok\":%s}\n",
+         c->name, heldKey, downs, ups, ok ? "true" : "false");
+  return ok;
+}
+
+int main(void) {
+  static const uint8_t heldKeys[] = { 0, KEY_Z };
+  bool ok = true;
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    for (size_t h = 0; h < sizeof(heldKeys); h++) {
+      ok &= run(&cases[c], heldKeys[h]);
+    }
+  }
+  return ok ? 0 : 1;
+}
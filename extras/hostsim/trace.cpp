@@ -0,0 +1,64 @@
+//*****************************************************************************
+//*     Debug Trace Demo                                                      *
+//*****************************************************************************
+//
+//      Builds the driver with DEBUG_LEVEL 2 and the binary trace buffer of
+//      oddebug.h, enumerates the keyboard on the simulated bus (see
+//      usbhostsim.h) and types a few keys. The bytes the device sends on
+//      its UART are written to stdout, ready for tracedecode. A JSON object
+//      on stderr gives the frames to SET_CONFIGURATION, which match a build
+//      without debugging since recording never waits for the UART, and the
+//      UART bytes sent.
+//
+//      Build and run from this directory:
+//
+//        FLAGS="-DUSB_HOST_SIM=1 -DUSB_COUNT_SOF=1 -DDEBUG_LEVEL=2
+//               -DODDBG_TRACE=512 -I../.."
+//        gcc $FLAGS -c ../../usbdrv.c ../../usbhostsim.c ../../oddebug.c
+//        g++ $FLAGS -o trace trace.cpp usbdrv.o
+//            usbhostsim.o oddebug.o
+//        g++ -o tracedecode tracedecode.cpp
+//        ./trace | ./tracedecode
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+
+#include "UsbKeyboard.h"
+
+// A smaller buffer drops records during enumeration, see oddebug.h.
+#if DEBUG_LEVEL < 2 || ODDBG_TRACE < 512
+#error "build with -DDEBUG_LEVEL=2 -DODDBG_TRACE=512"
+#endif
+
+static unsigned long uartBytes;
+
+static void deviceLoop(void) {
+  UsbKeyboard.update();
+}
+
+static void uartByte(unsigned char c) {
+  putchar(c);
+  uartBytes++;
+}
+
+int main() {
+  usbSimInit(deviceLoop);
+  usbSimSetUartHandler(uartByte);
+  UsbKeyboard.begin();
+
+  long configured = usbSimEnumerate();
+  if (configured < 0) {
+    fprintf(stderr, "enumeration failed\n");
+    return 1;
+  }
+  UsbKeyboard.sendString("Hi");
+
+  // Long enough for the queue and then the trace buffer to drain.
+  usbSimRunFrames(500);
+  fflush(stdout);
+  fprintf(stderr, "{\"ms_to_configured\":%ld,\"uart_bytes\":%lu}\n",
+          configured, uartBytes);
+  return 0;
+}
@@ -0,0 +1,64 @@
+//*****************************************************************************
+//*     Debug Trace Decoder                                                   *
+//*****************************************************************************
+//
+//      Reads the binary trace records oddebug.h sends with ODDBG_TRACE from
+//      stdin, e.g. a serial port or the output of trace.cpp, and prints one
+//      line per record: the frame stamp and the record in the text format
+//      of the printing odDebug(), the prefix and the data in hex. Records
+//      the device had to drop are reported with their count.
+//
+//      Prefixes used by usbdrv.c:
+//
+//        1x        data received, x is the low nibble of the token PID
+//                  (d: SETUP, 1: OUT)
+//        20        control IN data built by usbBuildTxBlock()
+//        21-23     interrupt IN data loaded by usbSetInterrupt() and friends
+//        ff        bus reset, logged by every usbPoll() during it
+//
+//      Build and run from this directory:
+//
+//        g++ -o tracedecode tracedecode.cpp
+//        ./tracedecode < trace.bin
+//
+//      License: GNU GPL v2
+//*****************************************************************************
+
+#include <stdio.h>
+
+#define ODDBG_DROPPED   0xfe    // prefix of the drop count record, oddebug.h
+
+int main() {
+  unsigned long records = 0, dropped = 0;
+  int prefix;
+
+  while ((prefix = getchar()) != EOF) {
+    unsigned char data[255];
+    int len = getchar();
+    int stamp = EOF;
+
+    if (len != EOF && fread(data, 1, len, stdin) == (size_t)len) {
+      stamp = getchar();
+    }
+    if (stamp == EOF) {
+      printf("truncated record %02x\n", prefix);
+      break;
+    }
+    printf("[sof %02x] ", stamp);
+    if (prefix == ODDBG_DROPPED && len == 2) {
+      unsigned count = data[0] | data[1] << 8;
+
+      printf("-- %u records dropped\n", count);
+      dropped += count;
+      continue;
+    }
+    printf("%02x:", prefix);
+    for (int i = 0; i < len; i++) {
+      printf(" %02x", data[i]);
+    }
+    printf("\n");
+    records++;
+  }
+  fprintf(stderr, "{\"records\":%lu,\"dropped\":%lu}\n", records, dropped);
+  return 0;
+}
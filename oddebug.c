@@ -7,16 +7,74 @@
  * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
  */
 
+#include "usbdrv.h"  /* usbconfig.h and usbSofCount */
 #include "oddebug.h"
 
-#if DEBUG_LEVEL > 0
+#if DEBUG_LEVEL > 0 && ODDBG_TRACE
+
+#if ODDBG_TRACE > 128
+typedef unsigned    traceIndex_t;
+#else
+typedef uchar       traceIndex_t;
+#endif
+
+static uchar        traceBuf[ODDBG_TRACE];
+static traceIndex_t traceHead;  /* next byte to write, runs freely */
+static traceIndex_t traceTail;  /* next byte to send, runs freely */
+static unsigned traceDropped;   /* records lost since the last drop record */
+
+static void traceByte(uchar c)
+{
+    traceBuf[traceHead++ & (ODDBG_TRACE - 1)] = c;
+}
+
+static void traceRecord(uchar prefix, uchar *data, uchar len)
+{
+    traceByte(prefix);
+    traceByte(len);
+    while(len--)
+        traceByte(*data++);
+#if USB_COUNT_SOF
+    traceByte(usbSofCount);
+#else
+    traceByte(0);
+#endif
+}
+
+void    odDebug(uchar prefix, uchar *data, uchar len)
+{
+    traceIndex_t    space = ODDBG_TRACE - (traceIndex_t)(traceHead - traceTail);
+
+    if(traceDropped != 0 && space >= 5){
+        uchar   count[2];
+        count[0] = traceDropped;
+        count[1] = traceDropped >> 8;
+        traceRecord(ODDBG_DROPPED, count, 2);
+        traceDropped = 0;
+        space -= 5;
+    }
+    if(traceDropped != 0 || space < len + 3u){
+        if(traceDropped != 0xffff)
+            traceDropped++;
+        return;
+    }
+    traceRecord(prefix, data, len);
+}
+
+void    odTraceFlush(void)
+{
+    while(traceTail != traceHead && ODDBG_TX_READY())
+        ODDBG_TX(traceBuf[traceTail++ & (ODDBG_TRACE - 1)]);
+}
+
+#elif DEBUG_LEVEL > 0
 
 #warning "Never compile production devices with debugging enabled"
 
 static void uartPutc(char c)
 {
-    while(!(ODDBG_USR & (1 << ODDBG_UDRE)));    /* wait for data register empty */
-    ODDBG_UDR = c;
+    while(!ODDBG_TX_READY());    /* wait for data register empty */
+    ODDBG_TX(c);
 }
 
 static uchar    hexAscii(uchar h)
@@ -20,6 +20,11 @@ calls are no-ops. If it is 1, DBG1 logs will appear, but not DBG2. If it is
 
 A debug log consists of a label ('prefix') to indicate which debug log created
 the output and a memory block to dump in hex ('data' and 'len').
+
+Printing a log waits for the UART for every character, which takes long enough
+to break USB timing. With 'ODDBG_TRACE' defined to the size of a RAM buffer,
+logs are recorded as binary records instead and odTraceFlush() sends them
+without waiting, see below.
 */
 
 
@@ -34,7 +39,7 @@ the output and a memory block to dump in hex ('data' and 'len').
 #   define  uchar   unsigned char
 #endif
 
-#if DEBUG_LEVEL > 0 && !(defined TXEN || defined TXEN0) /* no UART in device */
+#if DEBUG_LEVEL > 0 && !(defined TXEN || defined TXEN0 || defined USB_HOST_SIM) /* no UART in device */
 #   warning "Debugging disabled because device has no UART"
 #   undef   DEBUG_LEVEL
 #endif
@@ -43,6 +48,28 @@ the output and a memory block to dump in hex ('data' and 'len').
 #   define  DEBUG_LEVEL 0
 #endif
 
+#ifndef ODDBG_TRACE
+#   define  ODDBG_TRACE 0
+#endif
+/* Define this to the size of a RAM buffer in bytes, a power of 2 from 16 to
+ * 1024, to trace the debug logs instead of printing them. odDebug() then only
+ * appends a record to the buffer: the prefix, the length, the data and the
+ * low byte of usbSofCount (0 without USB_COUNT_SOF) as frame stamp. Call
+ * odTraceFlush() from the main loop; it hands buffered bytes to the UART for
+ * as long as the transmitter is free and returns as soon as it is not. A
+ * record that does not fit is dropped and counted, the count follows as a
+ * record with prefix ODDBG_DROPPED and a 16 bit little endian count once
+ * there is room again. extras/hostsim/tracedecode.cpp prints the stream.
+ * An enumeration logs about 550 bytes, a third of them reset records from
+ * every usbPoll() during SE0, in less time than the UART takes to send half
+ * of them: trace it with DEBUG_LEVEL 2 and 512 bytes to see all of it.
+ */
+#define ODDBG_DROPPED   0xfe
+
+#if ODDBG_TRACE && ((ODDBG_TRACE & (ODDBG_TRACE - 1)) || ODDBG_TRACE < 16 || ODDBG_TRACE > 1024)
+#   error "ODDBG_TRACE must be a power of 2 from 16 to 1024"
+#endif
+
 /* ------------------------------------------------------------------------- */
 
 #if DEBUG_LEVEL > 0
@@ -61,6 +88,20 @@ the output and a memory block to dump in hex ('data' and 'len').
 
 #if DEBUG_LEVEL > 0
 extern void odDebug(uchar prefix, uchar *data, uchar len);
+#endif
+
+#if DEBUG_LEVEL > 0 && ODDBG_TRACE
+extern void odTraceFlush(void);
+#else
+#   define odTraceFlush()
+#endif
+
+#if DEBUG_LEVEL > 0 && defined USB_HOST_SIM
+/* The host simulation models the UART, see usbhostsim.h */
+#   define  ODDBG_TX_READY()    usbSimUartReady()
+#   define  ODDBG_TX(c)         usbSimUartWrite(c)
+#   define  odDebugInit()
+#elif DEBUG_LEVEL > 0
 
 /* Try to find our control registers; ATMEL likes to rename these */
 
@@ -108,6 +149,9 @@ extern void odDebug(uchar prefix, uchar *data, uchar len);
 #   define  ODDBG_UDR   UDR0
 #endif
 
+#define ODDBG_TX_READY()    (ODDBG_USR & (1 << ODDBG_UDRE))
+#define ODDBG_TX(c)         (ODDBG_UDR = (c))
+
 static inline void  odDebugInit(void)
 {
     ODDBG_UCR |= (1<<ODDBG_TXEN);
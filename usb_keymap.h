@@ -90,6 +90,7 @@
 #define KEY_LEFT_BRACKET    0x2F    // Keyboard [ and {
 #define KEY_RIGHT_BRACKET   0x30    // Keyboard ] and }
 #define KEY_BACK_SLASH      0x31    // Keyboard \ and |
+#define KEY_NON_US_HASH     0x32    // Keyboard Non-US # and ~ (next to Enter)
 #define KEY_COLON           0x33    // Keyboard ; and :
 #define KEY_QUOTE           0x34    // Keyboard ' and "
 #define KEY_TILDE           0x35    // Keyboard ` and ~
@@ -145,6 +146,7 @@
 #define KEY_PAD_9           0x61    // Keyboard Num Pad 9 and Page Up
 #define KEY_PAD_0           0x62    // Keyboard Num Pad 0 and Insert
 #define KEY_PAD_PERIOD      0x63    // Keyboard Num Pad .
+#define KEY_NON_US_BACKSLASH 0x64   // Keyboard Non-US \ and | (next to left Shift)
 
 #define KEY_APP             0x65    // Keyboard Application
 #define KEY_PWR             0x66    // Keyboard Power
@@ -178,4 +180,45 @@
 #define KEY_VOL_UP          0x80    // Keyboard Volume Up
 #define KEY_VOL_DOWN        0x81    // Keyboard Volume Down
 
+/* US layout table translating 7 bit ASCII to the usage of the key which 
+ * types the character. ASCII_SHIFT is set if shift must be held as well,
+ * 0 means the character has no key. Read entries with pgm_read_byte().
+ */
+#define ASCII_SHIFT         0x80
+
+const PROGMEM uint8_t asciiToKeyMap[128] = {
+  0, 0, 0, 0,    // 00 01 02 03
+  0, 0, 0, 0,    // 04 05 06 07
+  KEY_BACKSPACE, KEY_TAB, KEY_ENTER, 0,    // \b \t \n 0b
+  0, 0, 0, 0,    // 0c 0d 0e 0f
+  0, 0, 0, 0,    // 10 11 12 13
+  0, 0, 0, 0,    // 14 15 16 17
+  0, 0, 0, KEY_ESCAPE,    // 18 19 1a ESC
+  0, 0, 0, 0,    // 1c 1d 1e 1f
+  KEY_SPACE, KEY_1 | ASCII_SHIFT, KEY_QUOTE | ASCII_SHIFT, KEY_3 | ASCII_SHIFT,    // space ! " #
+  KEY_4 | ASCII_SHIFT, KEY_5 | ASCII_SHIFT, KEY_7 | ASCII_SHIFT, KEY_QUOTE,    // $ % & '
+  KEY_9 | ASCII_SHIFT, KEY_0 | ASCII_SHIFT, KEY_8 | ASCII_SHIFT, KEY_EQUAL | ASCII_SHIFT,    // ( ) * +
+  KEY_COMMA, KEY_DASH, KEY_PERIOD, KEY_FORWARD_SLASH,    // , - . /
+  KEY_0, KEY_1, KEY_2, KEY_3,    // 0 1 2 3
+  KEY_4, KEY_5, KEY_6, KEY_7,    // 4 5 6 7
+  KEY_8, KEY_9, KEY_COLON | ASCII_SHIFT, KEY_COLON,    // 8 9 : ;
+  KEY_COMMA | ASCII_SHIFT, KEY_EQUAL, KEY_PERIOD | ASCII_SHIFT, KEY_FORWARD_SLASH | ASCII_SHIFT,    // < = > ?
+  KEY_2 | ASCII_SHIFT, KEY_A | ASCII_SHIFT, KEY_B | ASCII_SHIFT, KEY_C | ASCII_SHIFT,    // @ A B C
+  KEY_D | ASCII_SHIFT, KEY_E | ASCII_SHIFT, KEY_F | ASCII_SHIFT, KEY_G | ASCII_SHIFT,    // D E F G
+  KEY_H | ASCII_SHIFT, KEY_I | ASCII_SHIFT, KEY_J | ASCII_SHIFT, KEY_K | ASCII_SHIFT,    // H I J K
+  KEY_L | ASCII_SHIFT, KEY_M | ASCII_SHIFT, KEY_N | ASCII_SHIFT, KEY_O | ASCII_SHIFT,    // L M N O
+  KEY_P | ASCII_SHIFT, KEY_Q | ASCII_SHIFT, KEY_R | ASCII_SHIFT, KEY_S | ASCII_SHIFT,    // P Q R S
+  KEY_T | ASCII_SHIFT, KEY_U | ASCII_SHIFT, KEY_V | ASCII_SHIFT, KEY_W | ASCII_SHIFT,    // T U V W
+  KEY_X | ASCII_SHIFT, KEY_Y | ASCII_SHIFT, KEY_Z | ASCII_SHIFT, KEY_LEFT_BRACKET,    // X Y Z [
+  KEY_BACK_SLASH, KEY_RIGHT_BRACKET, KEY_6 | ASCII_SHIFT, KEY_DASH | ASCII_SHIFT,    // \ ] ^ _
+  KEY_TILDE, KEY_A, KEY_B, KEY_C,    // ` a b c
+  KEY_D, KEY_E, KEY_F, KEY_G,    // d e f g
+  KEY_H, KEY_I, KEY_J, KEY_K,    // h i j k
+  KEY_L, KEY_M, KEY_N, KEY_O,    // l m n o
+  KEY_P, KEY_Q, KEY_R, KEY_S,    // p q r s
+  KEY_T, KEY_U, KEY_V, KEY_W,    // t u v w
+  KEY_X, KEY_Y, KEY_Z, KEY_LEFT_BRACKET | ASCII_SHIFT,    // x y z {
+  KEY_BACK_SLASH | ASCII_SHIFT, KEY_RIGHT_BRACKET | ASCII_SHIFT, KEY_TILDE | ASCII_SHIFT, 0,    // | } ~ 7f
+};
+
 #endif // USB_KEYMAP
\ No newline at end of file
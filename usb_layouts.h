@@ -0,0 +1,273 @@
+//*****************************************************************************
+//*     usb_layouts Header                                                    *
+//*****************************************************************************
+//
+//      This file contains the keyboard layouts sendText() types with. The
+//      host translates usages to characters with its own layout setting,
+//      so to type a character the device has to press the key which gives
+//      it on that layout. Each table maps a character to that key, the
+//      modifiers to hold and the dead key to type first, if any.
+//
+//      License: GNU GPL v2
+//
+//*****************************************************************************
+#ifndef USB_LAYOUTS
+#define USB_LAYOUTS
+
+#define LAYOUT_US           0   // US, the asciiToKeyMap table of usb_keymap.h
+#define LAYOUT_UK           1   // UK (GB)
+#define LAYOUT_DE           2   // German (QWERTZ)
+#define LAYOUT_FR           3   // French (AZERTY)
+#define LAYOUT_COUNT        4
+
+#define LAYOUTS_WITH_DEAD_KEYS  ((1 << LAYOUT_DE) | (1 << LAYOUT_FR))
+
+// Layouts sendText() can type with, see setLayout(). KEYBOARD_LAYOUTS is a
+// bit mask of the layouts to compile in, 1 << LAYOUT_xx for each; only
+// those take flash (528 bytes each, US takes none).
+#ifndef KEYBOARD_LAYOUT
+#define KEYBOARD_LAYOUT     LAYOUT_US
+#endif
+
+#ifndef KEYBOARD_LAYOUTS
+#define KEYBOARD_LAYOUTS    (1 << KEYBOARD_LAYOUT)
+#endif
+
+#if !(KEYBOARD_LAYOUTS & (1 << KEYBOARD_LAYOUT))
+#error "KEYBOARD_LAYOUTS must include KEYBOARD_LAYOUT"
+#endif
+
+/* A table entry is the usage of the key in bits 0-7, the modifiers to hold
+ * with it and the number of the dead key which has to be typed before it,
+ * 0 for none. An entry of 0 means the layout cannot type the character.
+ * Entries 0-255 are indexed by the Latin-1 code point, except that 0x80
+ * (a C1 control) holds the euro sign, as in Windows-1252. Entries 257-263
+ * are the dead keys 1-7 themselves. Read entries with pgm_read_word().
+ */
+#define LAYOUT_SHIFT        0x0100          // hold left shift
+#define LAYOUT_ALTGR        0x0200          // hold right alt (AltGr)
+#define LAYOUT_DEAD(n)      ((n) << 12)     // type dead key n first
+#define LAYOUT_DEAD_KEY(e)  (((e) >> 12) & 7)
+
+#define LAYOUT_EURO         0x80    // index of U+20AC
+#define LAYOUT_NONE         0x100   // index of characters without an entry, always 0
+#define LAYOUT_DEAD_KEYS    0x100   // dead key n is at LAYOUT_DEAD_KEYS + n
+#define LAYOUT_ENTRIES      264
+
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_UK)
+// UK (GB), no dead keys
+const PROGMEM uint16_t layoutUK[LAYOUT_ENTRIES] = {
+  0, 0, 0, 0,    // 00 01 02 03
+  0, 0, 0, 0,    // 04 05 06 07
+  KEY_BACKSPACE, KEY_TAB, KEY_ENTER, 0,    // \b \t \n 0b
+  0, 0, 0, 0,    // 0c 0d 0e 0f
+  0, 0, 0, 0,    // 10 11 12 13
+  0, 0, 0, 0,    // 14 15 16 17
+  0, 0, 0, KEY_ESCAPE,    // 18 19 1a ESC
+  0, 0, 0, 0,    // 1c 1d 1e 1f
+  KEY_SPACE, KEY_1 | LAYOUT_SHIFT, KEY_2 | LAYOUT_SHIFT, KEY_NON_US_HASH,    // space ! " #
+  KEY_4 | LAYOUT_SHIFT, KEY_5 | LAYOUT_SHIFT, KEY_7 | LAYOUT_SHIFT, KEY_QUOTE,    // $ % & '
+  KEY_9 | LAYOUT_SHIFT, KEY_0 | LAYOUT_SHIFT, KEY_8 | LAYOUT_SHIFT, KEY_EQUAL | LAYOUT_SHIFT,    // ( ) * +
+  KEY_COMMA, KEY_DASH, KEY_PERIOD, KEY_FORWARD_SLASH,    // , - . /
+  KEY_0, KEY_1, KEY_2, KEY_3,    // 0 1 2 3
+  KEY_4, KEY_5, KEY_6, KEY_7,    // 4 5 6 7
+  KEY_8, KEY_9, KEY_COLON | LAYOUT_SHIFT, KEY_COLON,    // 8 9 : ;
+  KEY_COMMA | LAYOUT_SHIFT, KEY_EQUAL, KEY_PERIOD | LAYOUT_SHIFT, KEY_FORWARD_SLASH | LAYOUT_SHIFT,    // < = > ?
+  KEY_QUOTE | LAYOUT_SHIFT, KEY_A | LAYOUT_SHIFT, KEY_B | LAYOUT_SHIFT, KEY_C | LAYOUT_SHIFT,    // @ A B C
+  KEY_D | LAYOUT_SHIFT, KEY_E | LAYOUT_SHIFT, KEY_F | LAYOUT_SHIFT, KEY_G | LAYOUT_SHIFT,    // D E F G
+  KEY_H | LAYOUT_SHIFT, KEY_I | LAYOUT_SHIFT, KEY_J | LAYOUT_SHIFT, KEY_K | LAYOUT_SHIFT,    // H I J K
+  KEY_L | LAYOUT_SHIFT, KEY_M | LAYOUT_SHIFT, KEY_N | LAYOUT_SHIFT, KEY_O | LAYOUT_SHIFT,    // L M N O
+  KEY_P | LAYOUT_SHIFT, KEY_Q | LAYOUT_SHIFT, KEY_R | LAYOUT_SHIFT, KEY_S | LAYOUT_SHIFT,    // P Q R S
+  KEY_T | LAYOUT_SHIFT, KEY_U | LAYOUT_SHIFT, KEY_V | LAYOUT_SHIFT, KEY_W | LAYOUT_SHIFT,    // T U V W
+  KEY_X | LAYOUT_SHIFT, KEY_Y | LAYOUT_SHIFT, KEY_Z | LAYOUT_SHIFT, KEY_LEFT_BRACKET,    // X Y Z [
+  KEY_NON_US_BACKSLASH, KEY_RIGHT_BRACKET, KEY_6 | LAYOUT_SHIFT, KEY_DASH | LAYOUT_SHIFT,    // \ ] ^ _
+  KEY_TILDE, KEY_A, KEY_B, KEY_C,    // ` a b c
+  KEY_D, KEY_E, KEY_F, KEY_G,    // d e f g
+  KEY_H, KEY_I, KEY_J, KEY_K,    // h i j k
+  KEY_L, KEY_M, KEY_N, KEY_O,    // l m n o
+  KEY_P, KEY_Q, KEY_R, KEY_S,    // p q r s
+  KEY_T, KEY_U, KEY_V, KEY_W,    // t u v w
+  KEY_X, KEY_Y, KEY_Z, KEY_LEFT_BRACKET | LAYOUT_SHIFT,    // x y z {
+  KEY_NON_US_BACKSLASH | LAYOUT_SHIFT, KEY_RIGHT_BRACKET | LAYOUT_SHIFT, KEY_NON_US_HASH | LAYOUT_SHIFT, 0,    // | } ~ 7f
+  KEY_4 | LAYOUT_ALTGR, 0, 0, 0,    // € 81 82 83
+  0, 0, 0, 0,    // 84 85 86 87
+  0, 0, 0, 0,    // 88 89 8a 8b
+  0, 0, 0, 0,    // 8c 8d 8e 8f
+  0, 0, 0, 0,    // 90 91 92 93
+  0, 0, 0, 0,    // 94 95 96 97
+  0, 0, 0, 0,    // 98 99 9a 9b
+  0, 0, 0, 0,    // 9c 9d 9e 9f
+  0, 0, 0, KEY_3 | LAYOUT_SHIFT,    // nbsp ¡ ¢ £
+  0, 0, KEY_TILDE | LAYOUT_ALTGR, 0,    // ¤ ¥ ¦ §
+  0, 0, 0, 0,    // ¨ © ª «
+  KEY_TILDE | LAYOUT_SHIFT, 0, 0, 0,    // ¬ shy ® ¯
+  0, 0, 0, 0,    // ° ± ² ³
+  0, 0, 0, 0,    // ´ µ ¶ ·
+  0, 0, 0, 0,    // ¸ ¹ º »
+  0, 0, 0, 0,    // ¼ ½ ¾ ¿
+  0, KEY_A | LAYOUT_SHIFT | LAYOUT_ALTGR, 0, 0,    // À Á Â Ã
+  0, 0, 0, 0,    // Ä Å Æ Ç
+  0, KEY_E | LAYOUT_SHIFT | LAYOUT_ALTGR, 0, 0,    // È É Ê Ë
+  0, KEY_I | LAYOUT_SHIFT | LAYOUT_ALTGR, 0, 0,    // Ì Í Î Ï
+  0, 0, 0, KEY_O | LAYOUT_SHIFT | LAYOUT_ALTGR,    // Ð Ñ Ò Ó
+  0, 0, 0, 0,    // Ô Õ Ö ×
+  0, 0, KEY_U | LAYOUT_SHIFT | LAYOUT_ALTGR, 0,    // Ø Ù Ú Û
+  0, 0, 0, 0,    // Ü Ý Þ ß
+  0, KEY_A | LAYOUT_ALTGR, 0, 0,    // à á â ã
+  0, 0, 0, 0,    // ä å æ ç
+  0, KEY_E | LAYOUT_ALTGR, 0, 0,    // è é ê ë
+  0, KEY_I | LAYOUT_ALTGR, 0, 0,    // ì í î ï
+  0, 0, 0, KEY_O | LAYOUT_ALTGR,    // ð ñ ò ó
+  0, 0, 0, 0,    // ô õ ö ÷
+  0, 0, KEY_U | LAYOUT_ALTGR, 0,    // ø ù ú û
+  0, 0, 0, 0,    // ü ý þ ÿ
+  0, 0, 0, 0,    // unused, dead keys 1 2 3
+  0, 0, 0, 0,    // dead keys 4 5 6 7
+};
+#endif
+
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_DE)
+// German (QWERTZ), dead keys 1 ^, 2 ´ and 3 `
+const PROGMEM uint16_t layoutDE[LAYOUT_ENTRIES] = {
+  0, 0, 0, 0,    // 00 01 02 03
+  0, 0, 0, 0,    // 04 05 06 07
+  KEY_BACKSPACE, KEY_TAB, KEY_ENTER, 0,    // \b \t \n 0b
+  0, 0, 0, 0,    // 0c 0d 0e 0f
+  0, 0, 0, 0,    // 10 11 12 13
+  0, 0, 0, 0,    // 14 15 16 17
+  0, 0, 0, KEY_ESCAPE,    // 18 19 1a ESC
+  0, 0, 0, 0,    // 1c 1d 1e 1f
+  KEY_SPACE, KEY_1 | LAYOUT_SHIFT, KEY_2 | LAYOUT_SHIFT, KEY_NON_US_HASH,    // space ! " #
+  KEY_4 | LAYOUT_SHIFT, KEY_5 | LAYOUT_SHIFT, KEY_6 | LAYOUT_SHIFT, KEY_NON_US_HASH | LAYOUT_SHIFT,    // $ % & '
+  KEY_8 | LAYOUT_SHIFT, KEY_9 | LAYOUT_SHIFT, KEY_RIGHT_BRACKET | LAYOUT_SHIFT, KEY_RIGHT_BRACKET,    // ( ) * +
+  KEY_COMMA, KEY_FORWARD_SLASH, KEY_PERIOD, KEY_7 | LAYOUT_SHIFT,    // , - . /
+  KEY_0, KEY_1, KEY_2, KEY_3,    // 0 1 2 3
+  KEY_4, KEY_5, KEY_6, KEY_7,    // 4 5 6 7
+  KEY_8, KEY_9, KEY_PERIOD | LAYOUT_SHIFT, KEY_COMMA | LAYOUT_SHIFT,    // 8 9 : ;
+  KEY_NON_US_BACKSLASH, KEY_0 | LAYOUT_SHIFT, KEY_NON_US_BACKSLASH | LAYOUT_SHIFT, KEY_DASH | LAYOUT_SHIFT,    // < = > ?
+  KEY_Q | LAYOUT_ALTGR, KEY_A | LAYOUT_SHIFT, KEY_B | LAYOUT_SHIFT, KEY_C | LAYOUT_SHIFT,    // @ A B C
+  KEY_D | LAYOUT_SHIFT, KEY_E | LAYOUT_SHIFT, KEY_F | LAYOUT_SHIFT, KEY_G | LAYOUT_SHIFT,    // D E F G
+  KEY_H | LAYOUT_SHIFT, KEY_I | LAYOUT_SHIFT, KEY_J | LAYOUT_SHIFT, KEY_K | LAYOUT_SHIFT,    // H I J K
+  KEY_L | LAYOUT_SHIFT, KEY_M | LAYOUT_SHIFT, KEY_N | LAYOUT_SHIFT, KEY_O | LAYOUT_SHIFT,    // L M N O
+  KEY_P | LAYOUT_SHIFT, KEY_Q | LAYOUT_SHIFT, KEY_R | LAYOUT_SHIFT, KEY_S | LAYOUT_SHIFT,    // P Q R S
+  KEY_T | LAYOUT_SHIFT, KEY_U | LAYOUT_SHIFT, KEY_V | LAYOUT_SHIFT, KEY_W | LAYOUT_SHIFT,    // T U V W
+  KEY_X | LAYOUT_SHIFT, KEY_Z | LAYOUT_SHIFT, KEY_Y | LAYOUT_SHIFT, KEY_8 | LAYOUT_ALTGR,    // X Y Z [
+  KEY_DASH | LAYOUT_ALTGR, KEY_9 | LAYOUT_ALTGR, KEY_SPACE | LAYOUT_DEAD(1), KEY_FORWARD_SLASH | LAYOUT_SHIFT,    // \ ] ^ _
+  KEY_SPACE | LAYOUT_DEAD(3), KEY_A, KEY_B, KEY_C,    // ` a b c
+  KEY_D, KEY_E, KEY_F, KEY_G,    // d e f g
+  KEY_H, KEY_I, KEY_J, KEY_K,    // h i j k
+  KEY_L, KEY_M, KEY_N, KEY_O,    // l m n o
+  KEY_P, KEY_Q, KEY_R, KEY_S,    // p q r s
+  KEY_T, KEY_U, KEY_V, KEY_W,    // t u v w
+  KEY_X, KEY_Z, KEY_Y, KEY_7 | LAYOUT_ALTGR,    // x y z {
+  KEY_NON_US_BACKSLASH | LAYOUT_ALTGR, KEY_0 | LAYOUT_ALTGR, KEY_RIGHT_BRACKET | LAYOUT_ALTGR, 0,    // | } ~ 7f
+  KEY_E | LAYOUT_ALTGR, 0, 0, 0,    // € 81 82 83
+  0, 0, 0, 0,    // 84 85 86 87
+  0, 0, 0, 0,    // 88 89 8a 8b
+  0, 0, 0, 0,    // 8c 8d 8e 8f
+  0, 0, 0, 0,    // 90 91 92 93
+  0, 0, 0, 0,    // 94 95 96 97
+  0, 0, 0, 0,    // 98 99 9a 9b
+  0, 0, 0, 0,    // 9c 9d 9e 9f
+  0, 0, 0, 0,    // nbsp ¡ ¢ £
+  0, 0, 0, KEY_3 | LAYOUT_SHIFT,    // ¤ ¥ ¦ §
+  0, 0, 0, 0,    // ¨ © ª «
+  0, 0, 0, 0,    // ¬ shy ® ¯
+  KEY_TILDE | LAYOUT_SHIFT, 0, KEY_2 | LAYOUT_ALTGR, KEY_3 | LAYOUT_ALTGR,    // ° ± ² ³
+  KEY_SPACE | LAYOUT_DEAD(2), KEY_M | LAYOUT_ALTGR, 0, 0,    // ´ µ ¶ ·
+  0, 0, 0, 0,    // ¸ ¹ º »
+  0, 0, 0, 0,    // ¼ ½ ¾ ¿
+  KEY_A | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_A | LAYOUT_SHIFT | LAYOUT_DEAD(2), KEY_A | LAYOUT_SHIFT | LAYOUT_DEAD(1), 0,    // À Á Â Ã
+  KEY_QUOTE | LAYOUT_SHIFT, 0, 0, 0,    // Ä Å Æ Ç
+  KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(2), KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(1), 0,    // È É Ê Ë
+  KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(2), KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(1), 0,    // Ì Í Î Ï
+  0, 0, KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(2),    // Ð Ñ Ò Ó
+  KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(1), 0, KEY_COLON | LAYOUT_SHIFT, 0,    // Ô Õ Ö ×
+  0, KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(2), KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(1),    // Ø Ù Ú Û
+  KEY_LEFT_BRACKET | LAYOUT_SHIFT, KEY_Z | LAYOUT_SHIFT | LAYOUT_DEAD(2), 0, KEY_DASH,    // Ü Ý Þ ß
+  KEY_A | LAYOUT_DEAD(3), KEY_A | LAYOUT_DEAD(2), KEY_A | LAYOUT_DEAD(1), 0,    // à á â ã
+  KEY_QUOTE, 0, 0, 0,    // ä å æ ç
+  KEY_E | LAYOUT_DEAD(3), KEY_E | LAYOUT_DEAD(2), KEY_E | LAYOUT_DEAD(1), 0,    // è é ê ë
+  KEY_I | LAYOUT_DEAD(3), KEY_I | LAYOUT_DEAD(2), KEY_I | LAYOUT_DEAD(1), 0,    // ì í î ï
+  0, 0, KEY_O | LAYOUT_DEAD(3), KEY_O | LAYOUT_DEAD(2),    // ð ñ ò ó
+  KEY_O | LAYOUT_DEAD(1), 0, KEY_COLON, 0,    // ô õ ö ÷
+  0, KEY_U | LAYOUT_DEAD(3), KEY_U | LAYOUT_DEAD(2), KEY_U | LAYOUT_DEAD(1),    // ø ù ú û
+  KEY_LEFT_BRACKET, KEY_Z | LAYOUT_DEAD(2), 0, 0,    // ü ý þ ÿ
+  0, KEY_TILDE, KEY_EQUAL, KEY_EQUAL | LAYOUT_SHIFT,    // unused, dead keys 1 2 3
+  0, 0, 0, 0,    // dead keys 4 5 6 7
+};
+#endif
+
+#if KEYBOARD_LAYOUTS & (1 << LAYOUT_FR)
+// French (AZERTY), dead keys 1 ^, 2 ¨, 3 ~ and 4 `
+const PROGMEM uint16_t layoutFR[LAYOUT_ENTRIES] = {
+  0, 0, 0, 0,    // 00 01 02 03
+  0, 0, 0, 0,    // 04 05 06 07
+  KEY_BACKSPACE, KEY_TAB, KEY_ENTER, 0,    // \b \t \n 0b
+  0, 0, 0, 0,    // 0c 0d 0e 0f
+  0, 0, 0, 0,    // 10 11 12 13
+  0, 0, 0, 0,    // 14 15 16 17
+  0, 0, 0, KEY_ESCAPE,    // 18 19 1a ESC
+  0, 0, 0, 0,    // 1c 1d 1e 1f
+  KEY_SPACE, KEY_FORWARD_SLASH, KEY_3, KEY_3 | LAYOUT_ALTGR,    // space ! " #
+  KEY_RIGHT_BRACKET, KEY_QUOTE | LAYOUT_SHIFT, KEY_1, KEY_4,    // $ % & '
+  KEY_5, KEY_DASH, KEY_NON_US_HASH, KEY_EQUAL | LAYOUT_SHIFT,    // ( ) * +
+  KEY_M, KEY_6, KEY_COMMA | LAYOUT_SHIFT, KEY_PERIOD | LAYOUT_SHIFT,    // , - . /
+  KEY_0 | LAYOUT_SHIFT, KEY_1 | LAYOUT_SHIFT, KEY_2 | LAYOUT_SHIFT, KEY_3 | LAYOUT_SHIFT,    // 0 1 2 3
+  KEY_4 | LAYOUT_SHIFT, KEY_5 | LAYOUT_SHIFT, KEY_6 | LAYOUT_SHIFT, KEY_7 | LAYOUT_SHIFT,    // 4 5 6 7
+  KEY_8 | LAYOUT_SHIFT, KEY_9 | LAYOUT_SHIFT, KEY_PERIOD, KEY_COMMA,    // 8 9 : ;
+  KEY_NON_US_BACKSLASH, KEY_EQUAL, KEY_NON_US_BACKSLASH | LAYOUT_SHIFT, KEY_M | LAYOUT_SHIFT,    // < = > ?
+  KEY_0 | LAYOUT_ALTGR, KEY_Q | LAYOUT_SHIFT, KEY_B | LAYOUT_SHIFT, KEY_C | LAYOUT_SHIFT,    // @ A B C
+  KEY_D | LAYOUT_SHIFT, KEY_E | LAYOUT_SHIFT, KEY_F | LAYOUT_SHIFT, KEY_G | LAYOUT_SHIFT,    // D E F G
+  KEY_H | LAYOUT_SHIFT, KEY_I | LAYOUT_SHIFT, KEY_J | LAYOUT_SHIFT, KEY_K | LAYOUT_SHIFT,    // H I J K
+  KEY_L | LAYOUT_SHIFT, KEY_COLON | LAYOUT_SHIFT, KEY_N | LAYOUT_SHIFT, KEY_O | LAYOUT_SHIFT,    // L M N O
+  KEY_P | LAYOUT_SHIFT, KEY_A | LAYOUT_SHIFT, KEY_R | LAYOUT_SHIFT, KEY_S | LAYOUT_SHIFT,    // P Q R S
+  KEY_T | LAYOUT_SHIFT, KEY_U | LAYOUT_SHIFT, KEY_V | LAYOUT_SHIFT, KEY_Z | LAYOUT_SHIFT,    // T U V W
+  KEY_X | LAYOUT_SHIFT, KEY_Y | LAYOUT_SHIFT, KEY_W | LAYOUT_SHIFT, KEY_5 | LAYOUT_ALTGR,    // X Y Z [
+  KEY_8 | LAYOUT_ALTGR, KEY_DASH | LAYOUT_ALTGR, KEY_9 | LAYOUT_ALTGR, KEY_8,    // \ ] ^ _
+  KEY_SPACE | LAYOUT_DEAD(4), KEY_Q, KEY_B, KEY_C,    // ` a b c
+  KEY_D, KEY_E, KEY_F, KEY_G,    // d e f g
+  KEY_H, KEY_I, KEY_J, KEY_K,    // h i j k
+  KEY_L, KEY_COLON, KEY_N, KEY_O,    // l m n o
+  KEY_P, KEY_A, KEY_R, KEY_S,    // p q r s
+  KEY_T, KEY_U, KEY_V, KEY_Z,    // t u v w
+  KEY_X, KEY_Y, KEY_W, KEY_4 | LAYOUT_ALTGR,    // x y z {
+  KEY_6 | LAYOUT_ALTGR, KEY_EQUAL | LAYOUT_ALTGR, KEY_SPACE | LAYOUT_DEAD(3), 0,    // | } ~ 7f
+  KEY_E | LAYOUT_ALTGR, 0, 0, 0,    // € 81 82 83
+  0, 0, 0, 0,    // 84 85 86 87
+  0, 0, 0, 0,    // 88 89 8a 8b
+  0, 0, 0, 0,    // 8c 8d 8e 8f
+  0, 0, 0, 0,    // 90 91 92 93
+  0, 0, 0, 0,    // 94 95 96 97
+  0, 0, 0, 0,    // 98 99 9a 9b
+  0, 0, 0, 0,    // 9c 9d 9e 9f
+  0, 0, 0, KEY_RIGHT_BRACKET | LAYOUT_SHIFT,    // nbsp ¡ ¢ £
+  KEY_RIGHT_BRACKET | LAYOUT_ALTGR, 0, 0, KEY_FORWARD_SLASH | LAYOUT_SHIFT,    // ¤ ¥ ¦ §
+  KEY_SPACE | LAYOUT_DEAD(2), 0, 0, 0,    // ¨ © ª «
+  0, 0, 0, 0,    // ¬ shy ® ¯
+  KEY_DASH | LAYOUT_SHIFT, 0, KEY_TILDE, 0,    // ° ± ² ³
+  0, KEY_NON_US_HASH | LAYOUT_SHIFT, 0, 0,    // ´ µ ¶ ·
+  0, 0, 0, 0,    // ¸ ¹ º »
+  0, 0, 0, 0,    // ¼ ½ ¾ ¿
+  KEY_Q | LAYOUT_SHIFT | LAYOUT_DEAD(4), 0, KEY_Q | LAYOUT_SHIFT | LAYOUT_DEAD(1), KEY_Q | LAYOUT_SHIFT | LAYOUT_DEAD(3),    // À Á Â Ã
+  KEY_Q | LAYOUT_SHIFT | LAYOUT_DEAD(2), 0, 0, 0,    // Ä Å Æ Ç
+  KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(4), 0, KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(1), KEY_E | LAYOUT_SHIFT | LAYOUT_DEAD(2),    // È É Ê Ë
+  KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(4), 0, KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(1), KEY_I | LAYOUT_SHIFT | LAYOUT_DEAD(2),    // Ì Í Î Ï
+  0, KEY_N | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(4), 0,    // Ð Ñ Ò Ó
+  KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(1), KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(3), KEY_O | LAYOUT_SHIFT | LAYOUT_DEAD(2), 0,    // Ô Õ Ö ×
+  0, KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(4), 0, KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(1),    // Ø Ù Ú Û
+  KEY_U | LAYOUT_SHIFT | LAYOUT_DEAD(2), 0, 0, 0,    // Ü Ý Þ ß
+  KEY_0, 0, KEY_Q | LAYOUT_DEAD(1), KEY_Q | LAYOUT_DEAD(3),    // à á â ã
+  KEY_Q | LAYOUT_DEAD(2), 0, 0, KEY_9,    // ä å æ ç
+  KEY_7, KEY_2, KEY_E | LAYOUT_DEAD(1), KEY_E | LAYOUT_DEAD(2),    // è é ê ë
+  KEY_I | LAYOUT_DEAD(4), 0, KEY_I | LAYOUT_DEAD(1), KEY_I | LAYOUT_DEAD(2),    // ì í î ï
+  0, KEY_N | LAYOUT_DEAD(3), KEY_O | LAYOUT_DEAD(4), 0,    // ð ñ ò ó
+  KEY_O | LAYOUT_DEAD(1), KEY_O | LAYOUT_DEAD(3), KEY_O | LAYOUT_DEAD(2), 0,    // ô õ ö ÷
+  0, KEY_QUOTE, 0, KEY_U | LAYOUT_DEAD(1),    // ø ù ú û
+  KEY_U | LAYOUT_DEAD(2), 0, 0, KEY_Y | LAYOUT_DEAD(2),    // ü ý þ ÿ
+  0, KEY_LEFT_BRACKET, KEY_LEFT_BRACKET | LAYOUT_SHIFT, KEY_2 | LAYOUT_ALTGR,    // unused, dead keys 1 2 3
+  KEY_7 | LAYOUT_ALTGR, 0, 0, 0,    // dead keys 4 5 6 7
+};
+#endif
+
+#endif // USB_LAYOUTS
@@ -78,7 +78,15 @@ section at the end of this file).
  * default control endpoint 0 and an interrupt-in endpoint (any other endpoint
  * number).
  */
-#define USB_CFG_HAVE_INTRIN_ENDPOINT3   0
+#ifndef KEYBOARD_CONSUMER_EP3
+#define KEYBOARD_CONSUMER_EP3   0
+#endif
+/* Define this to 1 to send the Consumer Control report of UsbKeyboard.h on
+ * endpoint 3 instead of sharing endpoint 1 with the keyboard reports. The
+ * device then has a second HID interface, see the descriptor properties
+ * below.
+ */
+#define USB_CFG_HAVE_INTRIN_ENDPOINT3   KEYBOARD_CONSUMER_EP3
 /* Define this to 1 if you want to compile a version with three endpoints: The
  * default control endpoint 0, an interrupt-in endpoint 3 (or the number
  * configured below) and a catch-all default interrupt-in endpoint as above.
@@ -165,10 +173,13 @@ section at the end of this file).
 /* This macro (if defined) is executed when a USB SET_ADDRESS request was
  * received.
  */
+#ifndef USB_COUNT_SOF
 #define USB_COUNT_SOF                   0
+#endif
 /* define this macro to 1 if you need the global variable "usbSofCount" which
  * counts SOF packets. This feature requires that the hardware interrupt is
- * connected to D- instead of D+.
+ * connected to D- instead of D+. UsbKeyboard.h then times its scheduler by
+ * the host's frames instead of millis().
  */
 /* #ifdef __ASSEMBLER__
  * macro myAssemblerMacro
@@ -273,7 +284,20 @@ section at the end of this file).
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    35
+#ifndef KEYBOARD_NKRO
+#define KEYBOARD_NKRO   0
+#endif
+/* Define this to 1 to have UsbKeyboard.h report the keyboard state as a
+ * bitmap with one bit per usage (N-key rollover) instead of the array of
+ * BUFFER_SIZE-1 pressed keys. The bitmap does not fit into one low-speed
+ * packet and is sent as two reports with IDs 1 and 2. The report descriptor
+ * length below depends on this setting.
+ */
+#if KEYBOARD_NKRO
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    68
+#else
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    62
+#endif
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  * If you use this define, you must add a PROGMEM character array named
@@ -339,14 +363,28 @@ section at the end of this file).
  */
 
 #define USB_CFG_DESCR_PROPS_DEVICE                  0
+#if KEYBOARD_CONSUMER_EP3
+/* Hosts only read reports from the first interrupt-in endpoint of an HID
+ * interface, so endpoint 3 gets an interface of its own. UsbKeyboard.h
+ * provides the configuration descriptor and looks up the HID and report
+ * descriptors by interface in usbFunctionDescriptor().
+ */
+#define USB_CFG_DESCR_PROPS_CONFIGURATION           USB_PROP_LENGTH(59)
+#else
 #define USB_CFG_DESCR_PROPS_CONFIGURATION           0
+#endif
 #define USB_CFG_DESCR_PROPS_STRINGS                 0
 #define USB_CFG_DESCR_PROPS_STRING_0                0
 #define USB_CFG_DESCR_PROPS_STRING_VENDOR           0
 #define USB_CFG_DESCR_PROPS_STRING_PRODUCT          0
 #define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    0
+#if KEYBOARD_CONSUMER_EP3
+#define USB_CFG_DESCR_PROPS_HID                     USB_PROP_IS_DYNAMIC
+#define USB_CFG_DESCR_PROPS_HID_REPORT              USB_PROP_IS_DYNAMIC
+#else
 #define USB_CFG_DESCR_PROPS_HID                     0
 #define USB_CFG_DESCR_PROPS_HID_REPORT              0
+#endif
 #define USB_CFG_DESCR_PROPS_UNKNOWN                 0
 
 /* ----------------------- Optional MCU Description ------------------------ */
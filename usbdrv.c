@@ -65,7 +65,7 @@ optimizing hints:
 #if USB_CFG_DESCR_PROPS_STRING_0 == 0
 #undef USB_CFG_DESCR_PROPS_STRING_0
 #define USB_CFG_DESCR_PROPS_STRING_0    sizeof(usbDescriptorString0)
-PROGMEM const char usbDescriptorString0[] = { /* language descriptor */
+PROGMEM const usbDescriptorChar_t usbDescriptorString0[] = { /* language descriptor */
     4,          /* sizeof(usbDescriptorString0): length of descriptor in bytes */
     3,          /* descriptor type */
     0x09, 0x04, /* language index (0x0409 = US-English) */
@@ -106,7 +106,7 @@ PROGMEM const int usbDescriptorStringSerialNumber[] = {
 #if USB_CFG_DESCR_PROPS_DEVICE == 0
 #undef USB_CFG_DESCR_PROPS_DEVICE
 #define USB_CFG_DESCR_PROPS_DEVICE  sizeof(usbDescriptorDevice)
-PROGMEM const char usbDescriptorDevice[] = {    /* USB device descriptor */
+PROGMEM const usbDescriptorChar_t usbDescriptorDevice[] = {    /* USB device descriptor */
     18,         /* sizeof(usbDescriptorDevice): length of descriptor in bytes */
     USBDESCR_DEVICE,        /* descriptor type */
     0x10, 0x01,             /* USB version supported */
@@ -137,7 +137,7 @@ PROGMEM const char usbDescriptorDevice[] = {    /* USB device descriptor */
 #if USB_CFG_DESCR_PROPS_CONFIGURATION == 0
 #undef USB_CFG_DESCR_PROPS_CONFIGURATION
 #define USB_CFG_DESCR_PROPS_CONFIGURATION   sizeof(usbDescriptorConfiguration)
-PROGMEM const char usbDescriptorConfiguration[] = {    /* USB configuration descriptor */
+PROGMEM const usbDescriptorChar_t usbDescriptorConfiguration[] = {    /* USB configuration descriptor */
     9,          /* sizeof(usbDescriptorConfiguration): length of descriptor in bytes */
     USBDESCR_CONFIG,    /* descriptor type */
     18 + 7 * USB_CFG_HAVE_INTRIN_ENDPOINT + 7 * USB_CFG_HAVE_INTRIN_ENDPOINT3 +
@@ -192,12 +192,18 @@ PROGMEM const char usbDescriptorConfiguration[] = {    /* USB configuration desc
 
 /* ------------------------------------------------------------------------- */
 
+/* The token in the buffer is the one of the last packet sent. A packet which
+ * is still waiting in the buffer is the first one the host receives after
+ * the reset and must therefore carry the token that follows the initial one.
+ */
+#define USB_RESET_DATATOKEN(txLen)  ((txLen) & 0x10 ? USB_INITIAL_DATATOKEN : USB_INITIAL_DATATOKEN ^ USBPID_DATA0 ^ USBPID_DATA1)
+
 static inline void  usbResetDataToggling(void)
 {
 #if USB_CFG_HAVE_INTRIN_ENDPOINT && !USB_CFG_SUPPRESS_INTR_CODE
-    USB_SET_DATATOKEN1(USB_INITIAL_DATATOKEN);  /* reset data toggling for interrupt endpoint */
+    USB_SET_DATATOKEN1(USB_RESET_DATATOKEN(usbTxLen1));  /* reset data toggling for interrupt endpoint */
 #   if USB_CFG_HAVE_INTRIN_ENDPOINT3
-    USB_SET_DATATOKEN3(USB_INITIAL_DATATOKEN);  /* reset data toggling for interrupt endpoint */
+    USB_SET_DATATOKEN3(USB_RESET_DATATOKEN(usbTxLen3));  /* reset data toggling for interrupt endpoint */
 #   endif
 #endif
 }
@@ -216,34 +222,71 @@ static inline void  usbResetStall(void)
 
 #if !USB_CFG_SUPPRESS_INTR_CODE
 #if USB_CFG_HAVE_INTRIN_ENDPOINT
-static void usbGenericSetInterrupt(uchar *data, uchar len, usbTxStatus_t *txStatus)
+static uchar *usbGenericInterruptBuffer(usbTxStatus_t *txStatus)
 {
-uchar   *p;
-char    i;
+    if(!(txStatus->len & 0x10)){    /* packet buffer is not empty */
+        txStatus->len = USBPID_NAK; /* avoid sending outdated (overwritten) interrupt data */
+        txStatus->buffer[0] ^= USBPID_DATA0 ^ USBPID_DATA1; /* data was never sent, keep token */
+    }
+    return txStatus->buffer + 1;
+}
 
+static void usbGenericSendInterrupt(uchar len, usbTxStatus_t *txStatus)
+{
 #if USB_CFG_IMPLEMENT_HALT
     if(usbTxLen1 == USBPID_STALL)
         return;
 #endif
-    if(txStatus->len & 0x10){   /* packet buffer was empty */
-        txStatus->buffer[0] ^= USBPID_DATA0 ^ USBPID_DATA1; /* toggle token */
-    }else{
-        txStatus->len = USBPID_NAK; /* avoid sending outdated (overwritten) interrupt data */
-    }
-    p = txStatus->buffer + 1;
+    txStatus->buffer[0] ^= USBPID_DATA0 ^ USBPID_DATA1; /* toggle token */
+    txStatus->len = len + 4;    /* len must be given including sync byte */
+    DBG2(0x21 + (((int)(size_t)txStatus >> 3) & 3), txStatus->buffer, len + 3);
+}
+
+static void usbGenericCommitInterrupt(uchar len, usbTxStatus_t *txStatus)
+{
+    usbCrc16Append(&txStatus->buffer[1], len);
+    usbGenericSendInterrupt(len, txStatus);
+}
+
+static void usbGenericCommitInterruptCrc(uchar len, unsigned crc, usbTxStatus_t *txStatus)
+{
+    txStatus->buffer[1 + len] = crc;
+    txStatus->buffer[2 + len] = crc >> 8;
+    usbGenericSendInterrupt(len, txStatus);
+}
+
+static void usbGenericSetInterrupt(uchar *data, uchar len, usbTxStatus_t *txStatus)
+{
+uchar   *p;
+char    i;
+
+    p = usbGenericInterruptBuffer(txStatus);
     i = len;
     do{                         /* if len == 0, we still copy 1 byte, but that's no problem */
         *p++ = *data++;
     }while(--i > 0);            /* loop control at the end is 2 bytes shorter than at beginning */
-    usbCrc16Append(&txStatus->buffer[1], len);
-    txStatus->len = len + 4;    /* len must be given including sync byte */
-    DBG2(0x21 + (((int)txStatus >> 3) & 3), txStatus->buffer, len + 3);
+    usbGenericCommitInterrupt(len, txStatus);
 }
 
 USB_PUBLIC void usbSetInterrupt(uchar *data, uchar len)
 {
     usbGenericSetInterrupt(data, len, &usbTxStatus1);
 }
+
+USB_PUBLIC uchar *usbInterruptBuffer(void)
+{
+    return usbGenericInterruptBuffer(&usbTxStatus1);
+}
+
+USB_PUBLIC void usbCommitInterrupt(uchar len)
+{
+    usbGenericCommitInterrupt(len, &usbTxStatus1);
+}
+
+USB_PUBLIC void usbCommitInterruptCrc(uchar len, unsigned crc)
+{
+    usbGenericCommitInterruptCrc(len, crc, &usbTxStatus1);
+}
 #endif
 
 #if USB_CFG_HAVE_INTRIN_ENDPOINT3
@@ -251,6 +294,21 @@ USB_PUBLIC void usbSetInterrupt3(uchar *data, uchar len)
 {
     usbGenericSetInterrupt(data, len, &usbTxStatus3);
 }
+
+USB_PUBLIC uchar *usbInterruptBuffer3(void)
+{
+    return usbGenericInterruptBuffer(&usbTxStatus3);
+}
+
+USB_PUBLIC void usbCommitInterrupt3(uchar len)
+{
+    usbGenericCommitInterrupt(len, &usbTxStatus3);
+}
+
+USB_PUBLIC void usbCommitInterruptCrc3(uchar len, unsigned crc)
+{
+    usbGenericCommitInterruptCrc(len, crc, &usbTxStatus3);
+}
 #endif
 #endif /* USB_CFG_SUPPRESS_INTR_CODE */
 
@@ -397,6 +455,9 @@ uchar   index = rq->wIndex.bytes[0];
     SWITCH_CASE(USBRQ_SET_CONFIGURATION)    /* 9 */
         usbConfiguration = value;
         usbResetStall();
+#if USB_CFG_HAVE_INTRIN_ENDPOINT && !USB_CFG_SUPPRESS_INTR_CODE
+        usbResetDataToggling(); /* the host starts all endpoints with DATA0 */
+#endif
     SWITCH_CASE(USBRQ_GET_INTERFACE)        /* 10 */
         len = 1;
 #if USB_CFG_HAVE_INTRIN_ENDPOINT && !USB_CFG_SUPPRESS_INTR_CODE
@@ -497,21 +558,15 @@ static uchar usbDeviceRead(uchar *data, uchar len)
         }else
 #endif
         {
-            uchar i = len;
-            usbMsgPtr_t r = usbMsgPtr;
+            /* The source is fixed per message by the ROM flag. Each chunk is
+             * one block copy instead of a call per byte.
+             */
             if(usbMsgFlags & USB_FLG_MSGPTR_IS_ROM){    /* ROM data */
-                do{
-                    uchar c = USB_READ_FLASH(r);    /* assign to char size variable to enforce byte ops */
-                    *data++ = c;
-                    r++;
-                }while(--i);
+                USB_COPY_FLASH(data, usbMsgPtr, len);
             }else{  /* RAM data */
-                do{
-                    *data++ = *((uchar *)r);
-                    r++;
-                }while(--i);
+                memcpy(data, (uchar *)usbMsgPtr, len);
             }
-            usbMsgPtr = r;
+            usbMsgPtr += len;
         }
     }
     return len;
@@ -599,6 +654,7 @@ uchar   i;
     /* RESET condition, called multiple times during reset */
     usbNewDeviceAddr = 0;
     usbDeviceAddr = 0;
+    usbConfiguration = 0;   /* a reset returns the device to the default state */
     usbResetStall();
     DBG1(0xff, 0, 0);
 isNotReset:
@@ -616,13 +672,13 @@ USB_PUBLIC void usbInit(void)
     USB_INTR_CFG &= ~(USB_INTR_CFG_CLR);
 #endif
     USB_INTR_ENABLE |= (1 << USB_INTR_ENABLE_BIT);
-    usbResetDataToggling();
 #if USB_CFG_HAVE_INTRIN_ENDPOINT && !USB_CFG_SUPPRESS_INTR_CODE
     usbTxLen1 = USBPID_NAK;
 #if USB_CFG_HAVE_INTRIN_ENDPOINT3
     usbTxLen3 = USBPID_NAK;
 #endif
 #endif
+    usbResetDataToggling();
 }
 
 /* ------------------------------------------------------------------------- */
@@ -239,15 +239,33 @@ USB_PUBLIC void usbSetInterrupt(uchar *data, uchar len);
  * sent. If you set a new interrupt message before the old was sent, the
  * message already buffered will be lost.
  */
+USB_PUBLIC uchar *usbInterruptBuffer(void);
+USB_PUBLIC void usbCommitInterrupt(uchar len);
+USB_PUBLIC void usbCommitInterruptCrc(uchar len, unsigned crc);
+/* These two functions are a copy-free alternative to usbSetInterrupt():
+ * usbInterruptBuffer() returns the driver's transmit buffer for the next
+ * interrupt IN transfer, the caller writes up to 8 bytes of message to it
+ * and usbCommitInterrupt() appends the CRC and hands the message to the
+ * driver. Like with usbSetInterrupt(), a message which has not been sent
+ * yet is lost when usbInterruptBuffer() is called. While
+ * usbInterruptIsReady() is true the buffer still holds the message sent
+ * last until it is overwritten.
+ * usbCommitInterruptCrc() is the same as usbCommitInterrupt() but takes the
+ * CRC (as returned by usbCrc16()) from the caller, e.g. from a table of
+ * precomputed messages, instead of calculating it.
+ */
 #if USB_CFG_HAVE_INTRIN_ENDPOINT3
 USB_PUBLIC void usbSetInterrupt3(uchar *data, uchar len);
 #define usbInterruptIsReady3()   (usbTxLen3 & 0x10)
+USB_PUBLIC uchar *usbInterruptBuffer3(void);
+USB_PUBLIC void usbCommitInterrupt3(uchar len);
+USB_PUBLIC void usbCommitInterruptCrc3(uchar len, unsigned crc);
 /* Same as above for endpoint 3 */
 #endif
 #endif /* USB_CFG_HAVE_INTRIN_ENDPOINT */
 #if USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    /* simplified interface for backward compatibility */
 #define usbHidReportDescriptor  usbDescriptorHidReport
-/* should be declared as: PROGMEM char usbHidReportDescriptor[]; */
+/* should be declared as: PROGMEM usbDescriptorChar_t usbHidReportDescriptor[]; */
 /* If you implement an HID device, you need to provide a report descriptor.
  * The HID report descriptor syntax is a bit complex. If you understand how
  * report descriptors are constructed, we recommend that you use the HID
@@ -316,16 +334,24 @@ USB_PUBLIC void usbFunctionWriteOut(uchar *data, uchar len);
  *     USB_INTR_ENABLE &= ~(1 << USB_INTR_ENABLE_BIT)
  * or use cli() to disable interrupts globally.
  */
+#if USB_HOST_SIM    /* pointers don't fit into 16 bits on the host */
+extern unsigned usbCrc16(uchar *data, uchar len);
+#else
 extern unsigned usbCrc16(unsigned data, uchar len);
 #define usbCrc16(data, len) usbCrc16((unsigned)(data), len)
+#endif
 /* This function calculates the binary complement of the data CRC used in
  * USB data packets. The value is used to build raw transmit packets.
  * You may want to use this function for data checksums or to verify received
  * data. We enforce 16 bit calling conventions for compatibility with IAR's
  * tiny memory model.
  */
+#if USB_HOST_SIM
+extern unsigned usbCrc16Append(uchar *data, uchar len);
+#else
 extern unsigned usbCrc16Append(unsigned data, uchar len);
 #define usbCrc16Append(data, len)    usbCrc16Append((unsigned)(data), len)
+#endif
 /* This function is equivalent to usbCrc16() above, except that it appends
  * the 2 bytes CRC (lowbyte first) in the 'data' buffer after reading 'len'
  * bytes.
@@ -343,7 +369,9 @@ extern unsigned usbMeasureFrameLength(void);
 extern uchar    usbConfiguration;
 /* This value contains the current configuration set by the host. The driver
  * allows setting and querying of this variable with the USB SET_CONFIGURATION
- * and GET_CONFIGURATION requests, but does not use it otherwise.
+ * and GET_CONFIGURATION requests and clears it on USB RESET, but does not use
+ * it otherwise. It is non-zero from SET_CONFIGURATION on, i.e. once the host
+ * has finished enumerating the device and starts polling its endpoints.
  * You may want to reflect the "configured" status with a LED on the device or
  * switch on high power parts of the circuit only if the device is configured.
  */
@@ -458,29 +486,39 @@ extern volatile schar   usbRxLen;
  * arrays as declared below:
  */
 #ifndef __ASSEMBLER__
+/* The host simulation builds with a standard C++ compiler, which rejects
+ * descriptor bytes from 0x80 up in a char initializer as narrowing, so the
+ * descriptors are unsigned there.
+ */
+#ifdef USB_HOST_SIM
+typedef unsigned char   usbDescriptorChar_t;
+#else
+typedef char            usbDescriptorChar_t;
+#endif
+
 extern
 #if !(USB_CFG_DESCR_PROPS_DEVICE & USB_PROP_IS_RAM)
 PROGMEM const
 #endif
-char usbDescriptorDevice[];
+usbDescriptorChar_t usbDescriptorDevice[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_CONFIGURATION & USB_PROP_IS_RAM)
 PROGMEM const
 #endif
-char usbDescriptorConfiguration[];
+usbDescriptorChar_t usbDescriptorConfiguration[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_HID_REPORT & USB_PROP_IS_RAM)
 PROGMEM const
 #endif
-char usbDescriptorHidReport[];
+usbDescriptorChar_t usbDescriptorHidReport[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_STRING_0 & USB_PROP_IS_RAM)
 PROGMEM const
 #endif
-char usbDescriptorString0[];
+usbDescriptorChar_t usbDescriptorString0[];
 
 extern
 #if !(USB_CFG_DESCR_PROPS_STRING_VENDOR & USB_PROP_IS_RAM)
@@ -667,7 +705,11 @@ extern usbTxStatus_t   usbTxStatus1, usbTxStatus3;
 
 
 typedef union usbWord{
+#if USB_HOST_SIM    /* unsigned is wider than 16 bits on the host */
+    unsigned short  word;
+#else
     unsigned    word;
+#endif
     uchar       bytes[2];
 }usbWord_t;
 
@@ -0,0 +1,527 @@
+/* Name: usbhostsim.c
+ * Project: V-USB, virtual USB port for Atmel's(r) AVR(r) microcontrollers
+ * Creation Date: 2026-10-17
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+This module replaces usbdrvasm.S when the driver is built for the host with
+USB_HOST_SIM defined. It contains a C implementation of the CRC functions,
+the mocked I/O space and a simulated host plus serial interface engine. See
+usbhostsim.h for a description of the timing model.
+
+Build example (from the library directory):
+    gcc -DUSB_HOST_SIM=1 -I. -c usbdrv.c usbhostsim.c
+*/
+
+#if USB_HOST_SIM
+
+#include "usbdrv.h"
+
+/* driver internals shared with the assembler module, see usbdrv.c */
+extern uchar            usbRxBuf[2*USB_BUFSIZE];
+extern uchar            usbInputBufOffset;
+extern uchar            usbDeviceAddr;
+extern uchar            usbNewDeviceAddr;
+extern volatile schar   usbRxLen;
+extern uchar            usbCurrentTok;
+extern volatile uchar   usbTxLen;
+extern uchar            usbTxBuf[USB_BUFSIZE];
+
+volatile unsigned char  usbSimIo[0x100];
+
+usbSimStats_t           usbSimStats;
+unsigned long           usbSimFrame;
+unsigned char           usbSimSlot;
+unsigned char           usbSimPollsPerFrame = 4;
+unsigned char           usbSimPollInterval;
+unsigned char           usbSimConfigured;
+
+static usbSimDeviceLoop_t       deviceLoop;
+static usbSimReportHandler_t    reportHandler;
+static usbSimPacketHandler_t    packetHandler;
+static usbSimUartHandler_t      uartHandler;
+static unsigned long            uartFreeAt;     /* usbSimTime() the UART is free again */
+static uchar                    hostAddress;    /* address used in tokens */
+static uchar                    resetFrames;    /* remaining frames of SE0 */
+static uchar                    intrEndpoints;  /* bit n set: interrupt-in endpoint n exists */
+static uchar                    intrToken[16];  /* expected DATA PID per endpoint */
+
+#define SIM_STAGE_TIMEOUT       50  /* frames a control stage may take */
+#define SIM_ATTACH_DEBOUNCE     100 /* frames between attach and first reset */
+#define SIM_RESET_LENGTH        10  /* frames of SE0 for a bus reset */
+#define SIM_SET_ADDRESS_RECOVERY 2  /* frames after SET_ADDRESS */
+#define SIM_MAX_INTERFACES      4   /* interfaces enumerated */
+
+#define SIM_NAK                 -1
+#define SIM_STALL               -2
+#define SIM_TIMEOUT             -3
+
+/* ------------------------------------------------------------------------- */
+
+unsigned usbCrc16(uchar *data, uchar len)
+{
+unsigned    crc = 0xffff;
+uchar       i;
+
+    while(len--){
+        crc ^= *data++;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc ^ 0xffff;
+}
+
+unsigned usbCrc16Append(uchar *data, uchar len)
+{
+unsigned    crc = usbCrc16(data, len);
+
+    data[len] = crc;
+    data[len + 1] = crc >> 8;
+    return crc;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  deviceConnected(void)
+{
+#ifdef USB_CFG_PULLUP_IOPORTNAME
+    return (USB_PULLUP_DDR & USB_PULLUP_OUT & (1 << USB_CFG_PULLUP_BIT)) != 0;
+#else
+    return (USBDDR & (1 << USBMINUS)) == 0;
+#endif
+}
+
+/* The interrupt routine only answers if it can run and the token is for us.
+ * usbDeviceAddr is stored shifted left by one, as in the assembler module.
+ */
+static int  deviceListening(void)
+{
+    if(!deviceConnected() || resetFrames)
+        return 0;
+    if(!(SREG & (1 << SREG_I)) || !(USB_INTR_ENABLE & (1 << USB_INTR_ENABLE_BIT)))
+        return 0;
+    return usbDeviceAddr == (uchar)(hostAddress << 1);
+}
+
+/* Token (SETUP or OUT) followed by a data packet from the host. Returns 1 if
+ * the device acknowledged the packet, SIM_NAK or SIM_TIMEOUT otherwise.
+ */
+static int  sieOut(uchar token, uchar pid, const uchar *data, uchar len)
+{
+uchar   *p;
+
+    if(!deviceListening()){
+        usbSimStats.timeouts++;
+        return SIM_TIMEOUT;
+    }
+    usbCurrentTok = token;
+    if(usbRxLen != 0){
+        usbSimStats.ep0Naks++;
+        return SIM_NAK;
+    }
+    if(len == 0)    /* zero sized data packets are status phase only */
+        return 1;
+    p = usbRxBuf + usbInputBufOffset;
+    p[0] = pid;
+    memcpy(p + 1, data, len);
+    usbCrc16Append(p + 1, len);
+    usbRxToken = token;
+    usbInputBufOffset = USB_BUFSIZE - usbInputBufOffset;    /* swap buffers */
+    usbRxLen = len + 3;
+    return 1;
+}
+
+/* IN token from the host. Returns the payload length and copies the payload
+ * and data PID, or returns SIM_NAK, SIM_STALL or SIM_TIMEOUT.
+ */
+static int  sieIn(uchar ep, uchar *data, uchar *pid)
+{
+volatile uchar  *txLen = &usbTxLen;
+uchar           *txBuf = usbTxBuf;
+uchar           cnt, len;
+
+    if(!deviceListening()){
+        usbSimStats.timeouts++;
+        return SIM_TIMEOUT;
+    }
+    if(usbRxLen >= 1)   /* unprocessed input packet */
+        return SIM_NAK;
+#if USB_CFG_HAVE_INTRIN_ENDPOINT && !USB_CFG_SUPPRESS_INTR_CODE
+    if(ep != 0){
+        txLen = &usbTxLen1;
+        txBuf = usbTxBuf1;
+#if USB_CFG_HAVE_INTRIN_ENDPOINT3
+        if(ep == USB_CFG_EP3_NUMBER){
+            txLen = &usbTxLen3;
+            txBuf = usbTxBuf3;
+        }
+#endif
+    }
+#endif
+    cnt = *txLen;
+    if(cnt & 0x10)  /* all handshake tokens have bit 4 set */
+        return cnt == USBPID_STALL ? SIM_STALL : SIM_NAK;
+    *txLen = USBPID_NAK;
+    len = cnt - 4;
+    if(usbCrc16(txBuf + 1, len) != (unsigned)(txBuf[len + 1] | (txBuf[len + 2] << 8)))
+        usbSimStats.crcErrors++;
+    *pid = txBuf[0];
+    memcpy(data, txBuf + 1, len);
+    usbDeviceAddr = usbNewDeviceAddr << 1;  /* assigned after each data packet */
+    return len;
+}
+
+/* Performs the transaction of 'packet' with the device, fills in the
+ * device's response and passes the packet on to the packet handler. Returns
+ * the result of sieOut() or sieIn().
+ */
+static int  transact(usbSimPacket_t *packet)
+{
+int     r;
+
+    packet->step = usbSimFrame * usbSimPollsPerFrame + usbSimSlot;
+    packet->addr = hostAddress;
+    packet->responseLen = 0;
+    if(packet->token == USBPID_IN){
+        r = sieIn(packet->ep, packet->responseData, &packet->response);
+        if(r >= 0)
+            packet->responseLen = r;
+        else
+            packet->response = r == SIM_NAK ? USBPID_NAK : r == SIM_STALL ? USBPID_STALL : 0;
+    }else{
+        r = sieOut(packet->token, packet->pid, packet->data, packet->len);
+        packet->response = r == 1 ? USBPID_ACK : r == SIM_NAK ? USBPID_NAK : 0;
+    }
+    if(packetHandler != NULL)
+        packetHandler(packet);
+    return r;
+}
+
+static int  hostSendData(uchar token, uchar pid, const uchar *data, uchar len)
+{
+usbSimPacket_t  packet;
+
+    packet.token = token;
+    packet.ep = 0;
+    packet.pid = pid;
+    packet.len = len;
+    if(len != 0)
+        memcpy(packet.data, data, len);
+    return transact(&packet);
+}
+
+static int  hostReceive(uchar ep, uchar *data, uchar *pid)
+{
+usbSimPacket_t  packet;
+int             r;
+
+    packet.token = USBPID_IN;
+    packet.ep = ep;
+    packet.pid = 0;
+    packet.len = 0;
+    r = transact(&packet);
+    *pid = packet.response;
+    memcpy(data, packet.responseData, packet.responseLen);
+    return r;
+}
+
+static void pollInterruptEndpoint(uchar ep)
+{
+uchar   data[8], pid;
+int     len;
+
+    usbSimStats.intrPolls++;
+    len = hostReceive(ep, data, &pid);
+    if(len == SIM_NAK){
+        usbSimStats.intrNaks++;
+    }else if(len >= 0){
+        usbSimStats.intrPackets++;
+        if(pid != intrToken[ep])
+            usbSimStats.toggleErrors++;
+        intrToken[ep] = pid ^ USBPID_DATA0 ^ USBPID_DATA1;
+        if(reportHandler != NULL)
+            reportHandler(ep, data, len);
+    }
+}
+
+static void startOfFrame(void)
+{
+uchar   ep;
+
+    if(resetFrames){
+        if(--resetFrames == 0)
+            USBIN = (USBIN & ~USBMASK) | USBIDLE;
+        return;
+    }
+    if(!deviceConnected()){
+        usbSimConfigured = 0;
+        hostAddress = 0;
+        return;
+    }
+#if USB_COUNT_SOF
+    if(SREG & (1 << SREG_I))
+        usbSofCount++;
+#endif
+    if(usbSimConfigured && usbSimPollInterval && usbSimFrame % usbSimPollInterval == 0){
+        for(ep = 1; ep < 16; ep++){
+            if(intrEndpoints & (1 << ep))
+                pollInterruptEndpoint(ep);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+void    usbSimInit(usbSimDeviceLoop_t loop)
+{
+    memset(&usbSimStats, 0, sizeof(usbSimStats));
+    deviceLoop = loop;
+    reportHandler = NULL;
+    packetHandler = NULL;
+    uartHandler = NULL;
+    uartFreeAt = 0;
+    usbSimFrame = 0;
+    usbSimSlot = 0;
+    usbSimPollInterval = 0;
+    usbSimConfigured = 0;
+    hostAddress = 0;
+    resetFrames = 0;
+    intrEndpoints = 0;
+#if USB_COUNT_SOF
+    usbSofCount = 0;
+#endif
+    USBIN = (USBIN & ~USBMASK) | USBIDLE;
+}
+
+void    usbSimSetReportHandler(usbSimReportHandler_t handler)
+{
+    reportHandler = handler;
+}
+
+void    usbSimSetPacketHandler(usbSimPacketHandler_t handler)
+{
+    packetHandler = handler;
+}
+
+void    usbSimTransaction(usbSimPacket_t *packet)
+{
+    if(packet->token == USB_SIM_BUS_RESET){
+        usbSimBusReset(packet->len);
+        return;
+    }
+    hostAddress = packet->addr;
+    transact(packet);
+}
+
+void    usbSimSetUartHandler(usbSimUartHandler_t handler)
+{
+    uartHandler = handler;
+}
+
+#define UART_BYTE_US    (10 * 1000000UL / 19200)
+
+int     usbSimUartReady(void)
+{
+    return usbSimTime() >= uartFreeAt;
+}
+
+void    usbSimUartWrite(unsigned char c)
+{
+    unsigned long   now = usbSimTime();
+
+    uartFreeAt = (now > uartFreeAt ? now : uartFreeAt) + UART_BYTE_US;
+    if(uartHandler != NULL)
+        uartHandler(c);
+}
+
+unsigned long usbSimTime(void)
+{
+    return usbSimFrame * 1000 + usbSimSlot * 1000u / usbSimPollsPerFrame;
+}
+
+unsigned long millis(void)
+{
+    return usbSimFrame;
+}
+
+void    yield(void)
+{
+    usbSimStep();
+}
+
+void    usbSimStep(void)
+{
+    if(deviceLoop != NULL)
+        deviceLoop();
+    if(++usbSimSlot >= usbSimPollsPerFrame){
+        usbSimSlot = 0;
+        usbSimFrame++;
+        startOfFrame();
+    }
+}
+
+void    usbSimRunFrames(unsigned frames)
+{
+unsigned long   end = usbSimFrame + frames;
+
+    while(usbSimFrame < end)
+        usbSimStep();
+}
+
+void    usbSimBusReset(unsigned frames)
+{
+    if(frames == 0)
+        return;
+    if(packetHandler != NULL){
+        usbSimPacket_t  packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.step = usbSimFrame * usbSimPollsPerFrame + usbSimSlot;
+        packet.token = USB_SIM_BUS_RESET;
+        packet.len = frames;
+        packetHandler(&packet);
+    }
+    resetFrames = frames;
+    USBIN &= ~USBMASK;
+    hostAddress = 0;
+    usbSimConfigured = 0;
+    while(resetFrames)
+        usbSimStep();
+}
+
+int     usbSimControl(const unsigned char setup[8], unsigned char *data)
+{
+unsigned        wLength = setup[6] | (setup[7] << 8);
+unsigned        done = 0;
+unsigned long   deadline = usbSimFrame + SIM_STAGE_TIMEOUT;
+uchar           buf[8], pid, token = USBPID_DATA1;
+int             r;
+
+    while(hostSendData(USBPID_SETUP, USBPID_DATA0, setup, 8) != 1){
+        if(usbSimFrame >= deadline)
+            return -1;
+        usbSimStep();
+    }
+    usbSimStats.setups++;
+    usbSimStep();
+    if(setup[0] & USBRQ_DIR_DEVICE_TO_HOST){
+        while(done < wLength){
+            deadline = usbSimFrame + SIM_STAGE_TIMEOUT;
+            while((r = hostReceive(0, buf, &pid)) < 0){
+                if(r == SIM_STALL || usbSimFrame >= deadline)
+                    return -1;
+                if(r == SIM_NAK)
+                    usbSimStats.ep0Naks++;
+                usbSimStep();
+            }
+            usbSimStats.ep0Packets++;
+            if((unsigned)r > wLength - done)
+                r = wLength - done;
+            memcpy(data + done, buf, r);
+            done += r;
+            usbSimStep();
+            if(r < 8)   /* a short packet ends the data stage */
+                break;
+        }
+        deadline = usbSimFrame + SIM_STAGE_TIMEOUT;
+        while(hostSendData(USBPID_OUT, USBPID_DATA1, NULL, 0) != 1){
+            if(usbSimFrame >= deadline)
+                return -1;
+            usbSimStep();
+        }
+    }else{
+        while(done < wLength){
+            uchar n = wLength - done > 8 ? 8 : wLength - done;
+            deadline = usbSimFrame + SIM_STAGE_TIMEOUT;
+            while(hostSendData(USBPID_OUT, token, data + done, n) != 1){
+                if(usbSimFrame >= deadline)
+                    return -1;
+                usbSimStep();
+            }
+            token ^= USBPID_DATA0 ^ USBPID_DATA1;
+            done += n;
+            usbSimStep();
+        }
+        deadline = usbSimFrame + SIM_STAGE_TIMEOUT;
+        while((r = hostReceive(0, buf, &pid)) < 0){
+            if(r == SIM_STALL || usbSimFrame >= deadline)
+                return -1;
+            if(r == SIM_NAK)
+                usbSimStats.ep0Naks++;
+            usbSimStep();
+        }
+    }
+    usbSimStep();
+    return done;
+}
+
+long    usbSimEnumerate(void)
+{
+static const uchar  getDevice[8] = {USBRQ_DIR_DEVICE_TO_HOST, USBRQ_GET_DESCRIPTOR, 0, USBDESCR_DEVICE, 0, 0, 18, 0};
+static const uchar  setAddress[8] = {0, USBRQ_SET_ADDRESS, 1, 0, 0, 0, 0, 0};
+static const uchar  setConfiguration[8] = {0, USBRQ_SET_CONFIGURATION, 1, 0, 0, 0, 0, 0};
+uchar               setIdle[8] = {USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE, USBRQ_HID_SET_IDLE, 0, 0, 0, 0, 0, 0};
+uchar               getConfig[8] = {USBRQ_DIR_DEVICE_TO_HOST, USBRQ_GET_DESCRIPTOR, 0, USBDESCR_CONFIG, 0, 0, 9, 0};
+uchar               getReport[8] = {USBRQ_DIR_DEVICE_TO_HOST | USBRQ_RCPT_INTERFACE, USBRQ_GET_DESCRIPTOR, 0, USBDESCR_HID_REPORT, 0, 0, 0, 0};
+unsigned short      reportLength[SIM_MAX_INTERFACES];   /* 0 if not HID */
+uchar               buf[256];
+unsigned long       start, deadline = usbSimFrame + 1000;
+int                 len, i, interface = 0;
+
+    while(!deviceConnected()){
+        if(usbSimFrame >= deadline)
+            return -1;
+        usbSimStep();
+    }
+    start = usbSimFrame;
+    usbSimRunFrames(SIM_ATTACH_DEBOUNCE);
+    usbSimBusReset(SIM_RESET_LENGTH);
+    if(usbSimControl(getDevice, buf) < 8)
+        return -1;
+    if(usbSimControl(setAddress, NULL) < 0)
+        return -1;
+    hostAddress = 1;
+    usbSimRunFrames(SIM_SET_ADDRESS_RECOVERY);
+    if(usbSimControl(getDevice, buf) != 18)
+        return -1;
+    if(usbSimControl(getConfig, buf) != 9)
+        return -1;
+    getConfig[6] = buf[2];
+    if((len = usbSimControl(getConfig, buf)) != buf[2])
+        return -1;
+    intrEndpoints = 0;
+    memset(reportLength, 0, sizeof(reportLength));
+    for(i = 0; i + 1 < len && buf[i] != 0; i += buf[i]){
+        if(buf[i + 1] == USBDESCR_INTERFACE){
+            interface = buf[i + 2] % SIM_MAX_INTERFACES;
+        }else if(buf[i + 1] == USBDESCR_ENDPOINT && (buf[i + 2] & 0x80) && (buf[i + 3] & 3) == 3){
+            intrEndpoints |= 1 << (buf[i + 2] & 0xf);
+            if(usbSimPollInterval == 0)
+                usbSimPollInterval = buf[i + 6];
+        }else if(buf[i + 1] == USBDESCR_HID){
+            reportLength[interface] = buf[i + 7] | (buf[i + 8] << 8);
+        }
+    }
+    if(usbSimControl(setConfiguration, NULL) < 0)
+        return -1;
+    for(i = 0; i < 16; i++)
+        intrToken[i] = USBPID_DATA0;
+    for(interface = 0; interface < SIM_MAX_INTERFACES; interface++){
+        if(reportLength[interface] == 0)
+            continue;
+        if(reportLength[interface] > sizeof(buf))
+            return -1;
+        setIdle[4] = getReport[4] = interface;
+        getReport[6] = reportLength[interface] & 0xff;
+        getReport[7] = reportLength[interface] >> 8;
+        usbSimControl(setIdle, NULL);   /* optional, may be stalled */
+        if(usbSimControl(getReport, buf) != reportLength[interface])
+            return -1;
+    }
+    usbSimConfigured = 1;
+    return usbSimFrame - start;
+}
+
+#endif  /* USB_HOST_SIM */
@@ -0,0 +1,340 @@
+/* Name: usbhostsim.h
+ * Project: V-USB, virtual USB port for Atmel's(r) AVR(r) microcontrollers
+ * Creation Date: 2026-10-17
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt), GNU GPL v3 or proprietary (CommercialLicense.txt)
+ */
+
+/*
+General Description:
+This header is the host (x86 Linux) backend of usbportability.h. It is
+selected by compiling with -DUSB_HOST_SIM=1 and lets usbdrv.c and
+UsbKeyboard.h build unchanged with the native gcc/g++.
+
+The AVR I/O space is replaced by a plain RAM array, cli()/sei() toggle the
+I flag in the mocked SREG and PROGMEM data lives in ordinary memory. The
+assembler receiver is replaced by a simulated serial interface engine (SIE)
+in usbhostsim.c: it writes SETUP and OUT packets into usbRxBuf/usbRxLen and
+consumes IN packets from usbTxBuf/usbTxLen and usbTxStatus1/3 exactly like
+the interrupt routine in asmcommon.inc does.
+
+Timing model:
+Time advances in 1 ms frames. Each frame is split into usbSimPollsPerFrame
+slots and the device main loop (the callback given to usbSimInit(), which
+should call usbPoll() or UsbKeyboard.update()) runs once per slot. The host
+performs at most one transaction per slot, so the device always runs between
+two packets just like a main loop racing the USB interrupt. The interrupt-in
+endpoints are polled at the start of every frame which is a multiple of the
+bInterval the host read from the endpoint descriptors during enumeration,
+i.e. USB_CFG_INTR_POLL_INTERVAL unless usbSimPollInterval is overridden.
+
+Limitations:
+String descriptors are declared as 'int' arrays by the driver. Since int is
+32 bits wide on the host, their layout does not match the wire format and
+the simulated host never requests them.
+*/
+
+#ifndef __usbhostsim_h_INCLUDED__
+#define __usbhostsim_h_INCLUDED__
+
+#include <stdint.h>
+#include <string.h>
+
+/* ------------------------------------------------------------------------- */
+/* -------------------- AVR compatibility definitions ---------------------- */
+/* ------------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile unsigned char usbSimIo[0x100];
+/* Mocked data space of an ATmega328 from 0x00 to 0xff. Registers are mapped
+ * at their data space addresses so that #if defined checks in usbdrv.h work.
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#define PINB    usbSimIo[0x23]
+#define DDRB    usbSimIo[0x24]
+#define PORTB   usbSimIo[0x25]
+#define PINC    usbSimIo[0x26]
+#define DDRC    usbSimIo[0x27]
+#define PORTC   usbSimIo[0x28]
+#define PIND    usbSimIo[0x29]
+#define DDRD    usbSimIo[0x2a]
+#define PORTD   usbSimIo[0x2b]
+#define EIFR    usbSimIo[0x3c]
+#define EIMSK   usbSimIo[0x3d]
+#define SREG    usbSimIo[0x5f]
+#define EICRA   usbSimIo[0x69]
+
+#define ISC00   0
+#define ISC01   1
+#define INT0    0
+#define INTF0   0
+#define SREG_I  7
+
+#define _BV(x)  (1 << (x))
+#define cli()   (SREG &= ~(1 << SREG_I))
+#define sei()   (SREG |= (1 << SREG_I))
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(addr)     (*(const unsigned char *)(addr))
+#define pgm_read_word(addr)     (*(const unsigned short *)(addr))
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+
+#define USB_READ_FLASH(addr)    pgm_read_byte(addr)
+#define USB_COPY_FLASH(dst, src, len)   memcpy(dst, (const void *)(src), len)
+
+/* The Arduino core time base used by UsbKeyboard.h, driven by usbSimFrame,
+ * and yield(), which Arduino calls while a sketch waits. Here it lets the
+ * time of one slot pass with usbSimStep(), so code waiting for the host
+ * makes progress. Never call it from the device loop.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+unsigned long millis(void);
+void yield(void);
+#ifdef __cplusplus
+}
+
+/* The part of the Arduino core's Print class UsbKeyboard.h builds on, with
+ * the same formatting: numbers are formatted into a buffer and written at
+ * once, a double is written sign, integer part, point and digit by digit.
+ */
+#include <stddef.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+public:
+    Print() : writeError(0) {}
+    virtual ~Print() {}
+
+    int     getWriteError() { return writeError; }
+    void    clearWriteError() { setWriteError(0); }
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+
+        while(size--){
+            if(write(*buffer++) == 0)
+                break;
+            n++;
+        }
+        return n;
+    }
+    size_t  write(const char *str) { return str == NULL ? 0 : write((const uint8_t *)str, strlen(str)); }
+    size_t  write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t  print(const char *s) { return write(s); }
+    size_t  print(char c) { return write((uint8_t)c); }
+    size_t  print(unsigned char b, int base = DEC) { return print((unsigned long)b, base); }
+    size_t  print(int n, int base = DEC) { return print((long)n, base); }
+    size_t  print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t  print(long n, int base = DEC)
+    {
+        if(base == 0)
+            return write((uint8_t)n);
+        if(base == 10 && n < 0){
+            size_t t = print('-');
+            return printNumber(0UL - (unsigned long)n, 10) + t;
+        }
+        return printNumber(n, base);
+    }
+    size_t  print(unsigned long n, int base = DEC)
+    {
+        return base == 0 ? write((uint8_t)n) : printNumber(n, base);
+    }
+    size_t  print(double number, int digits = 2) { return printFloat(number, digits); }
+
+    size_t  println(void) { return write("\r\n"); }
+    size_t  println(const char *s) { size_t n = print(s); return n + println(); }
+    size_t  println(char c) { size_t n = print(c); return n + println(); }
+    size_t  println(int n, int base = DEC) { size_t t = print(n, base); return t + println(); }
+    size_t  println(unsigned int n, int base = DEC) { size_t t = print(n, base); return t + println(); }
+    size_t  println(long n, int base = DEC) { size_t t = print(n, base); return t + println(); }
+    size_t  println(unsigned long n, int base = DEC) { size_t t = print(n, base); return t + println(); }
+    size_t  println(double n, int digits = 2) { size_t t = print(n, digits); return t + println(); }
+
+protected:
+    void    setWriteError(int err = 1) { writeError = err; }
+
+private:
+    int     writeError;
+
+    size_t  printNumber(unsigned long n, uint8_t base)
+    {
+        char    buf[8 * sizeof(long) + 1];
+        char    *str = &buf[sizeof(buf) - 1];
+
+        *str = '\0';
+        if(base < 2)
+            base = 10;
+        do{
+            char c = n % base;
+            n /= base;
+            *--str = c < 10 ? c + '0' : c + 'A' - 10;
+        }while(n);
+        return write(str);
+    }
+
+    size_t  printFloat(double number, uint8_t digits)
+    {
+        size_t n = 0;
+
+        if(number != number)
+            return print("nan");
+        if(number > 4294967040.0 || number < -4294967040.0)
+            return print("ovf");
+        if(number < 0.0){
+            n += print('-');
+            number = -number;
+        }
+        double rounding = 0.5;
+        for(uint8_t i = 0; i < digits; ++i)
+            rounding /= 10.0;
+        number += rounding;
+
+        unsigned long intPart = (unsigned long)number;
+        double remainder = number - (double)intPart;
+        n += print(intPart);
+        if(digits > 0)
+            n += print('.');
+        while(digits-- > 0){
+            remainder *= 10.0;
+            unsigned int toPrint = (unsigned int)remainder;
+            n += print(toPrint);
+            remainder -= toPrint;
+        }
+        return n;
+    }
+};
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* --------------------------- Simulated bus ------------------------------- */
+/* ------------------------------------------------------------------------- */
+
+#ifndef __ASSEMBLER__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*usbSimDeviceLoop_t)(void);
+/* One iteration of the device's main loop, called once per slot. */
+
+typedef void (*usbSimReportHandler_t)(unsigned char ep, const unsigned char *data, unsigned char len);
+/* Called for every data packet the host receives on an interrupt-in
+ * endpoint. 'ep' is the endpoint number, 'data' the payload without PID
+ * and CRC.
+ */
+
+typedef struct usbSimStats{
+    unsigned long   setups;         /* SETUP transactions accepted */
+    unsigned long   ep0Naks;        /* NAKs on control endpoint (IN, SETUP, OUT) */
+    unsigned long   ep0Packets;     /* data packets received on endpoint 0 */
+    unsigned long   intrPolls;      /* interrupt-in tokens sent */
+    unsigned long   intrNaks;       /* interrupt-in tokens answered with NAK */
+    unsigned long   intrPackets;    /* interrupt-in data packets received */
+    unsigned long   timeouts;       /* tokens the device did not answer */
+    unsigned long   toggleErrors;   /* DATA0/DATA1 sequence violations on interrupt-in */
+    unsigned long   crcErrors;      /* IN packets with a bad CRC */
+}usbSimStats_t;
+
+extern usbSimStats_t    usbSimStats;
+extern unsigned long    usbSimFrame;        /* current frame number (ms) */
+extern unsigned char    usbSimSlot;         /* current slot within the frame */
+extern unsigned char    usbSimPollsPerFrame;/* device loop iterations per frame, default 4 */
+extern unsigned char    usbSimPollInterval; /* interrupt-in bInterval, 0 until enumerated */
+extern unsigned char    usbSimConfigured;   /* host has set a configuration */
+
+void    usbSimInit(usbSimDeviceLoop_t deviceLoop);
+/* Resets the bus model, the statistics, the frame counter behind millis()
+ * and, with USB_COUNT_SOF, usbSofCount. Must be called before anything else.
+ * Initialize the device afterwards, with UsbKeyboard.begin() or usbInit(),
+ * so that its timing starts at 0.
+ */
+void    usbSimSetReportHandler(usbSimReportHandler_t handler);
+unsigned long usbSimTime(void);
+/* Current simulation time in microseconds. */
+void    usbSimStep(void);
+/* Runs the device loop once and advances to the next slot. At the start of
+ * each frame SOF is counted and interrupt-in endpoints are polled if due.
+ */
+void    usbSimRunFrames(unsigned frames);
+/* Calls usbSimStep() for the given number of whole frames. */
+void    usbSimBusReset(unsigned frames);
+/* Drives SE0 for the given number of frames. */
+int     usbSimControl(const unsigned char setup[8], unsigned char *data);
+/* Performs a complete control transfer on endpoint 0: SETUP stage, the
+ * optional IN or OUT data stage (wLength bytes to/from 'data') and the status
+ * stage. Returns the number of data bytes transferred or -1 on STALL or
+ * timeout (50 ms per stage).
+ */
+long    usbSimEnumerate(void);
+/* Runs the enumeration sequence of a typical host: wait for the pull-up,
+ * debounce, reset, read the device descriptor, assign address 1, read the
+ * configuration descriptor, SET_CONFIGURATION 1, then SET_IDLE and read the
+ * report descriptor of every HID interface. Returns the number of frames
+ * from pull-up detection until the device is configured or -1 on failure.
+ */
+
+#define USB_SIM_BUS_RESET       0   /* usbSimPacket_t token of a bus reset */
+
+typedef struct usbSimPacket{
+    unsigned long   step;           /* usbSimFrame * usbSimPollsPerFrame + usbSimSlot */
+    unsigned char   token;          /* USBPID_SETUP, USBPID_OUT, USBPID_IN or USB_SIM_BUS_RESET */
+    unsigned char   addr;           /* device address of the token */
+    unsigned char   ep;             /* endpoint number of the token, 0 for SETUP and OUT */
+    unsigned char   pid;            /* DATA0 or DATA1 of the host's data packet */
+    unsigned char   len;            /* length of 'data', frames of SE0 for a bus reset */
+    unsigned char   data[8];        /* host's payload for SETUP and OUT */
+    unsigned char   response;       /* device: USBPID_ACK, _NAK, _STALL, _DATA0/1, 0 for none */
+    unsigned char   responseLen;    /* length of 'responseData' */
+    unsigned char   responseData[8];/* device's payload for IN, without CRC */
+}usbSimPacket_t;
+
+typedef void (*usbSimPacketHandler_t)(const usbSimPacket_t *packet);
+/* Called after every transaction on the bus and at the start of every bus
+ * reset, for capturing packet traces.
+ */
+
+void    usbSimSetPacketHandler(usbSimPacketHandler_t handler);
+void    usbSimTransaction(usbSimPacket_t *packet);
+/* Performs the transaction given by the token, address, endpoint and data
+ * of 'packet' now, between two iterations of the device loop, and fills in
+ * the device's response. A bus reset runs like usbSimBusReset(). Together
+ * with usbSimConfigured left 0, so that the host sends nothing on its own,
+ * this replays a captured trace.
+ */
+
+typedef void (*usbSimUartHandler_t)(unsigned char c);
+/* Called for every byte the device sends on its UART. */
+
+void    usbSimSetUartHandler(usbSimUartHandler_t handler);
+int     usbSimUartReady(void);
+void    usbSimUartWrite(unsigned char c);
+/* The UART of oddebug.h: a byte takes 10 bits at 19200 baud, about 0.52 ms,
+ * and usbSimUartReady() is false until the previous one is out, like the
+ * data register empty flag of the AVR.
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* __ASSEMBLER__ */
+
+#endif  /* __usbhostsim_h_INCLUDED__ */
@@ -23,7 +23,9 @@ Thanks to Oleg Semyonov for his help with the IAR tools port!
 #ifndef __usbportability_h_INCLUDED__
 #define __usbportability_h_INCLUDED__
 
-/* We check explicitly for IAR and CodeVision. Default is avr-gcc/avr-libc. */
+/* We check explicitly for IAR, CodeVision and the host simulation. Default is
+ * avr-gcc/avr-libc.
+ */
 
 /* ------------------------------------------------------------------------- */
 #if defined __IAR_SYSTEMS_ICC__ || defined __IAR_SYSTEMS_ASM__  /* check for IAR */
@@ -37,6 +39,7 @@ Thanks to Oleg Semyonov for his help with the IAR tools port!
 #include <ioavr.h>
 #ifndef __IAR_SYSTEMS_ASM__
 #   include <inavr.h>
+#   include <string.h>
 #endif
 
 #define __attribute__(arg)  /* not supported on IAR */
@@ -89,6 +92,9 @@ Thanks to Oleg Semyonov for his help with the IAR tools port!
 
 #include <io.h>
 #include <delay.h>
+#ifndef __ASSEMBLER__
+#   include <string.h>
+#endif
 
 #define __attribute__(arg)  /* not supported on IAR */
 
@@ -113,6 +119,12 @@ static inline void  sei(void)
 #define endm    .endmacro
 #define nop2    rjmp    .+0 /* jump to next instruction */
 
+/* ------------------------------------------------------------------------- */
+#elif USB_HOST_SIM  /* host build with simulated bus, see usbhostsim.h */
+/* ------------------------------------------------------------------------- */
+
+#include "usbhostsim.h"
+
 /* ------------------------------------------------------------------------- */
 #else   /* default development environment is avr-gcc/avr-libc */
 /* ------------------------------------------------------------------------- */
@@ -122,12 +134,14 @@ static inline void  sei(void)
 #   define _VECTOR(N)   __vector_ ## N   /* io.h does not define this for asm */
 #else
 #   include <avr/pgmspace.h>
+#   include <string.h>
 #endif
 
 #if USB_CFG_DRIVER_FLASH_PAGE
 #   define USB_READ_FLASH(addr)    pgm_read_byte_far(((long)USB_CFG_DRIVER_FLASH_PAGE << 16) | (long)(addr))
 #else
 #   define USB_READ_FLASH(addr)    pgm_read_byte(addr)
+#   define USB_COPY_FLASH(dst, src, len)   memcpy_P(dst, (const void *)(src), len) /* lpm Z+ loop */
 #endif
 
 #define macro   .macro
@@ -136,6 +150,21 @@ static inline void  sei(void)
 
 #endif  /* development environment */
 
+/* USB_COPY_FLASH(dst, src, len) copies len > 0 bytes from flash to RAM. The
+ * fallback reads one byte at a time for environments without a block copy.
+ */
+#ifndef USB_COPY_FLASH
+#   define USB_COPY_FLASH(dst, src, len)   do{                         \
+        uchar *d_ = (dst), n_ = (len);                                  \
+        usbMsgPtr_t s_ = (usbMsgPtr_t)(src);                            \
+        do{                                                             \
+            uchar c_ = USB_READ_FLASH(s_);                              \
+            *d_++ = c_;                                                 \
+            s_++;                                                       \
+        }while(--n_);                                                   \
+    }while(0)
+#endif
+
 /* for conveniecne, ensure that PRG_RDB exists */
 #ifndef PRG_RDB
 #   define PRG_RDB(addr)    USB_READ_FLASH(addr)